@@ -0,0 +1,420 @@
+#include "ModuleLoader.hh"
+#include "../generated/Parser.hh"
+#include "../generated/Lexer.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+int yyparse(FileNode** rootNode, yyscan_t scanner);
+
+// The parser keeps all of its state in `scanner`, so modules can be parsed on
+// several threads at once.
+FileNode* getAst(const char* programText) {
+  FileNode *rootNode;
+  yyscan_t scanner;
+  YY_BUFFER_STATE state;
+
+  if (yylex_init(&scanner)) {
+    return NULL;
+  }
+  //printf("yylex_init\n");
+
+  state = yy_scan_string(programText, scanner);
+  //printf("yy_scan_string\n");
+
+  if (yyparse(&rootNode, scanner)) {
+    return NULL;
+  }
+  //printf("yyparse\n");
+
+  yy_delete_buffer(state, scanner);
+  //printf("yy_delete_buffer\n");
+
+  yylex_destroy(scanner);
+  //printf("yylex_destroy\n");
+
+  return rootNode;
+}
+
+static double millisSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+static bool isNameChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'
+    || c == '.';
+}
+
+// Reads the `@import` declarations at the top of a module and blanks them
+// out, keeping line breaks so the parser sees the rest where it was. The
+// grammar has no annotations yet, so this is the only place they are read.
+static std::vector<Import> scanImports(std::string &source,
+    const std::string &moduleName) {
+  std::vector<Import> imports;
+  size_t pos = 0;
+  auto skipSpace = [&]() {
+    while (pos < source.size() && std::isspace(source[pos])) {
+      pos++;
+    }
+  };
+  auto expect = [&](const char *text) {
+    size_t length = std::char_traits<char>::length(text);
+    if (source.compare(pos, length, text) != 0) {
+      throw LoadError(moduleName + ": malformed import, expected `" + text
+        + "`");
+    }
+    pos += length;
+  };
+
+  skipSpace();
+  while (source.compare(pos, 7, "@import") == 0) {
+    size_t start = pos;
+    Import import;
+    pos += 7;
+    skipSpace();
+    expect("#[");
+    skipSpace();
+    while (pos < source.size() && source[pos] != ']') {
+      size_t nameStart = pos;
+      while (pos < source.size() && isNameChar(source[pos])) {
+        pos++;
+      }
+      if (pos == nameStart) {
+        throw LoadError(moduleName + ": malformed import, expected a name");
+      }
+      import.names.push_back(source.substr(nameStart, pos - nameStart));
+      skipSpace();
+    }
+    expect("]");
+    skipSpace();
+    expect("from:");
+    skipSpace();
+    expect("\"");
+    size_t end = source.find('"', pos);
+    if (end == std::string::npos) {
+      throw LoadError(moduleName + ": unterminated import path");
+    }
+    import.from = source.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (import.from.empty() || import.from[0] == '@') {
+      throw LoadError(moduleName + ": cannot import from \"" + import.from
+        + "\", only files can be imported");
+    }
+    for (size_t i = start; i < pos; i++) {
+      if (source[i] != '\n') {
+        source[i] = ' ';
+      }
+    }
+    imports.push_back(import);
+    skipSpace();
+  }
+  return imports;
+}
+
+static std::string directoryOf(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// Where `from` points, relative to the directory `dir`. A path without an
+// extension names a `.lush` file.
+static std::string joinImportPath(const std::string &dir,
+    const std::string &from) {
+  std::string path = from[0] == '/' ? from : dir + "/" + from;
+  size_t dot;
+  while ((dot = path.find("/./")) != std::string::npos) {
+    path.erase(dot, 2);
+  }
+  if (path.compare(0, 2, "./") == 0) {
+    path.erase(0, 2);
+  }
+
+  size_t slash = path.rfind('/');
+  if (path.find('.', slash == std::string::npos ? 0 : slash + 1)
+      == std::string::npos) {
+    path += ".lush";
+  }
+  return path;
+}
+
+static std::string canonicalPath(const std::string &path) {
+  char *resolved = realpath(path.c_str(), nullptr);
+  if (resolved == nullptr) {
+    return "";
+  }
+  std::string canonical(resolved);
+  std::free(resolved);
+  return canonical;
+}
+
+static std::string definedName(DefinitionNode &def) {
+  switch (def.getType()) {
+  case NodeType::VariableDef:
+    return static_cast<VariableDefNode&>(def).getVariableRef()
+      .getQualifiedIdent();
+  case NodeType::FunctionDef:
+    return static_cast<FunctionDefNode&>(def).getHeader().getVariableRef()
+      .getQualifiedIdent();
+  default:
+    return "";
+  }
+}
+
+ModuleLoader::ModuleLoader(unsigned threads): threadCount(threads) {
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+// Must be called with `mutex` held. Threads are started as work turns up, so a
+// program without imports is loaded on the calling thread alone, and none are
+// started after a failure, once `loadProgram` may be joining them.
+Module *ModuleLoader::discover(const std::string &name,
+    const std::string &path) {
+  std::unique_ptr<Module> &entry = modules[path];
+  if (entry) {
+    return entry.get();
+  }
+
+  entry.reset(new Module());
+  entry->name = name;
+  entry->path = path;
+  discovered.push_back(entry.get());
+  queue.push_back(entry.get());
+  unfinished++;
+
+  if (discovered.size() > 1 && error.empty()
+      && workers.size() + 1 < threadCount) {
+    workers.emplace_back(&ModuleLoader::work, this);
+    threadsUsed = workers.size() + 1;
+  } else {
+    wake.notify_one();
+  }
+  return entry.get();
+}
+
+void ModuleLoader::load(Module &module) {
+  Clock::time_point start = Clock::now();
+  if (&module != root) {
+    std::ifstream in(module.path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    if (!in) {
+      throw LoadError("cannot read " + module.name);
+    }
+    module.source = text.str();
+  }
+
+  module.imports = scanImports(module.source, module.name);
+  for (Import &import : module.imports) {
+    std::string name = joinImportPath(
+      &module == root ? rootDir : directoryOf(module.name), import.from);
+    std::string path = canonicalPath(name);
+    if (path.empty()) {
+      throw LoadError(module.name + " imports \"" + import.from
+        + "\", but there is no " + name);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    import.module = discover(name, path);
+  }
+  module.scanMillis = millisSince(start);
+
+  start = Clock::now();
+  module.ast = getAst(module.source.c_str());
+  if (module.ast == nullptr) {
+    throw LoadError("cannot parse " + module.name);
+  }
+  ExpressionNode *exp = &module.ast->getRootExpression();
+  while (exp->getType() == NodeType::Block) {
+    BlockNode *block = static_cast<BlockNode*>(exp);
+    module.definitions.push_back(&block->getDefinition());
+    exp = &block->getExpression();
+  }
+  module.parseMillis = millisSince(start);
+}
+
+// Loads queued modules until every discovered one is loaded or one fails.
+void ModuleLoader::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] {
+      return !queue.empty() || unfinished == 0 || !error.empty();
+    });
+    if (unfinished == 0 || !error.empty()) {
+      return;
+    }
+    Module *module = queue.front();
+    queue.pop_front();
+    lock.unlock();
+
+    std::string failure;
+    try {
+      load(*module);
+    } catch (std::runtime_error &err) {
+      failure = err.what();
+    }
+
+    lock.lock();
+    if (!failure.empty() && error.empty()) {
+      error = failure;
+    }
+    unfinished--;
+    if (unfinished == 0 || !error.empty()) {
+      wake.notify_all();
+    }
+  }
+}
+
+// Orders modules after everything they import, rejecting cycles.
+void ModuleLoader::sort(Module &module, std::map<Module*, int> &state,
+    std::vector<Module*> &stack) {
+  enum { Unvisited, Visiting, Done };
+  state[&module] = Visiting;
+  stack.push_back(&module);
+  for (Import &import : module.imports) {
+    int importState = state[import.module];
+    if (importState == Visiting) {
+      std::string cycle;
+      auto first = std::find(stack.begin(), stack.end(), import.module);
+      for (auto it = first; it != stack.end(); ++it) {
+        cycle += (*it)->name + " -> ";
+      }
+      throw LoadError("import cycle: " + cycle + import.module->name);
+    }
+    if (importState == Unvisited) {
+      sort(*import.module, state, stack);
+    }
+  }
+  stack.pop_back();
+  state[&module] = Done;
+  linkOrder.push_back(&module);
+}
+
+// A module starts loading as soon as the first of its importers has read its
+// imports, so it can start no earlier than the quickest chain of reads from
+// the program down to it, and finish after its own read and parse. Importers
+// come first in reverse link order, so each start is settled before it is
+// used.
+void ModuleLoader::measureCriticalPath(Module &program) {
+  std::map<Module*, double> startAt;
+  std::map<Module*, Module*> reachedFrom;
+  startAt[&program] = 0;
+  reachedFrom[&program] = nullptr;
+
+  Module *last = &program;
+  criticalMillis = 0;
+  for (auto it = linkOrder.rbegin(); it != linkOrder.rend(); ++it) {
+    Module *module = *it;
+    double ready = startAt[module] + module->scanMillis;
+    for (Import &import : module->imports) {
+      Module *dep = import.module;
+      if (!reachedFrom.count(dep) || ready < startAt[dep]) {
+        startAt[dep] = ready;
+        reachedFrom[dep] = module;
+      }
+    }
+    double finish = ready + module->parseMillis;
+    if (finish >= criticalMillis) {
+      criticalMillis = finish;
+      last = module;
+    }
+  }
+
+  criticalPath.clear();
+  for (Module *module = last; module != nullptr;
+      module = reachedFrom[module]) {
+    criticalPath.push_back(module);
+  }
+  std::reverse(criticalPath.begin(), criticalPath.end());
+}
+
+FileNode *ModuleLoader::link(Module &program) {
+  std::map<Module*, int> state;
+  std::vector<Module*> stack;
+  linkOrder.clear();
+  sort(program, state, stack);
+
+  for (Module *module : linkOrder) {
+    for (Import &import : module->imports) {
+      for (std::string &name : import.names) {
+        std::vector<DefinitionNode*> &defs = import.module->definitions;
+        bool defined = std::any_of(defs.begin(), defs.end(),
+          [&](DefinitionNode *def) { return definedName(*def) == name; });
+        if (!defined) {
+          throw LoadError(module->name + " imports " + name + " from "
+            + import.module->name + ", which does not define it");
+        }
+      }
+    }
+  }
+  measureCriticalPath(program);
+
+  if (linkOrder.size() == 1) {
+    return program.ast;
+  }
+  // Innermost first, so the deepest dependency ends up outermost.
+  ExpressionNode *exp = &program.ast->getRootExpression();
+  for (auto it = linkOrder.rbegin() + 1; it != linkOrder.rend(); ++it) {
+    std::vector<DefinitionNode*> &defs = (*it)->definitions;
+    for (auto def = defs.rbegin(); def != defs.rend(); ++def) {
+      exp = new BlockNode(**def, *exp);
+    }
+  }
+  return new FileNode(*exp);
+}
+
+FileNode *ModuleLoader::loadProgram(const std::string &text,
+    const std::string &dir) {
+  Clock::time_point start = Clock::now();
+  std::string base = canonicalPath(dir);
+  if (base.empty()) {
+    throw LoadError("cannot find directory " + dir);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    rootDir = dir;
+    root = discover("<stdin>", base + "/<stdin>");
+    root->source = text;
+  }
+  work();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  if (!error.empty()) {
+    throw LoadError(error);
+  }
+
+  FileNode *program = link(*root);
+  wallMillis = millisSince(start);
+  return program;
+}
+
+void ModuleLoader::printReport(std::ostream &out) const {
+  double scan = 0;
+  double parse = 0;
+  for (Module *module : discovered) {
+    scan += module->scanMillis;
+    parse += module->parseMillis;
+  }
+
+  out << "modules:          " << discovered.size() << " on " << threadsUsed
+    << (threadsUsed == 1 ? " thread\n" : " threads\n");
+  out << "total work:       " << scan + parse << " ms (" << scan
+    << " ms reading, " << parse << " ms parsing)\n";
+  out << "critical path:    " << criticalMillis << " ms";
+  for (size_t i = 0; i < criticalPath.size(); i++) {
+    out << (i == 0 ? " (" : " -> ") << criticalPath[i]->name;
+  }
+  out << (criticalPath.empty() ? "\n" : ")\n");
+  out << "wall time:        " << wallMillis << " ms\n";
+  if (criticalMillis > 0) {
+    out << "parallelism:      " << (scan + parse) / criticalMillis << "x\n";
+  }
+}
@@ -0,0 +1,108 @@
+#ifndef SRC_MODULELOADER_HH
+#define SRC_MODULELOADER_HH
+
+#include "ast/Node.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parses one buffer. Returns null after reporting a syntax error.
+FileNode *getAst(const char *programText);
+
+// Raised for a missing or unreadable module, a malformed import or an import
+// cycle.
+class LoadError: public std::runtime_error {
+public:
+  LoadError(const std::string &msg): std::runtime_error(msg) {}
+};
+
+struct Module;
+
+// `@import #[names] from: "./path"`
+struct Import {
+  std::vector<std::string> names;
+  std::string from;
+  Module *module = nullptr;
+};
+
+struct Module {
+  // As it was reached, for messages, and as resolved, to load it only once.
+  std::string name;
+  std::string path;
+  std::string source;
+  std::vector<Import> imports;
+
+  FileNode *ast = nullptr;
+  // The top-level definitions, in source order.
+  std::vector<DefinitionNode*> definitions;
+
+  // Reading the file and its imports, after which the modules it imports can
+  // start loading, and parsing the rest.
+  double scanMillis = 0;
+  double parseMillis = 0;
+};
+
+// Loads a program and every module it imports. Imports are declared at the top
+// of a file and are found before it is parsed, so each newly discovered module
+// is queued right away and independent modules are read and parsed in
+// parallel. Every module is loaded once, however many files import it.
+//
+// Once the graph is complete it is checked for cycles and for imported names
+// that are not defined, then linked into one AST: each module's definitions
+// wrap the program, dependencies outermost, so they resolve lexically like
+// the definitions of a single file. A module's other top-level definitions
+// come into scope along with the names it exports.
+class ModuleLoader {
+  typedef std::chrono::steady_clock Clock;
+
+  unsigned threadCount;
+  std::map<std::string, std::unique_ptr<Module>> modules;
+  std::vector<Module*> discovered;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Module*> queue;
+  size_t unfinished = 0;
+  std::string error;
+  std::vector<std::thread> workers;
+  Module *root = nullptr;
+  std::string rootDir;
+  unsigned threadsUsed = 1;
+
+  // Filled in by `link`.
+  std::vector<Module*> linkOrder;
+  double criticalMillis = 0;
+  std::vector<Module*> criticalPath;
+  double wallMillis = 0;
+
+  Module *discover(const std::string &name, const std::string &path);
+  void load(Module &module);
+  void work();
+  void sort(Module &module, std::map<Module*, int> &state,
+    std::vector<Module*> &stack);
+  void measureCriticalPath(Module &root);
+  FileNode *link(Module &root);
+
+public:
+  // With no thread count, one thread per core is used.
+  explicit ModuleLoader(unsigned threads = 0);
+
+  // Loads the program in `text`, whose imports are resolved from `dir`.
+  FileNode *loadProgram(const std::string &text, const std::string &dir);
+
+  size_t moduleCount() const { return discovered.size(); }
+  // Total work against the critical path, the shortest the load could take
+  // with unlimited threads.
+  void printReport(std::ostream &out) const;
+};
+
+#endif
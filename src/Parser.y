@@ -4,7 +4,12 @@
   #include "../src/ast/Node.hh"
   #include <string>
 
-  int yyerror(FileNode** rootNode, yyscan_t scanner, const char* msg);
+  int yyerror(
+    YYLTYPE* location,
+    FileNode** rootNode,
+    yyscan_t scanner,
+    const char* msg
+  );
   #define YYDEBUG 1
 %}
 
@@ -25,6 +30,7 @@ https://www.gnu.org/software/bison/manual/bison.html#GLR-Parsers */
 %verbose
 %define parse.error verbose /* vebose errors during development. */
 %define api.pure /* define a reentrant parser */
+%locations /* where functions start, for the profiler and errors */
 %define parse.trace
 %lex-param { yyscan_t scanner }
 %parse-param { FileNode** rootNode }
@@ -370,6 +376,8 @@ parenthetical
 lambda_function
   : T_BACKSLASH function_params T_EQUALS expression {
     $$ = new LambdaFunctionNode(*$2, *$4);
+    $$->getLocation().line = @1.first_line;
+    $$->getLocation().column = @1.first_column;
   }
   ;
 
@@ -400,6 +408,8 @@ variable_def
 function_def
   : function_def_header function_params T_EQUALS expression {
     $$ = new FunctionDefNode(*$1, *$2, *$4);
+    $$->getLocation().line = @1.first_line;
+    $$->getLocation().column = @1.first_column;
   }
   ;
 
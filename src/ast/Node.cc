@@ -149,3 +149,13 @@ void StructTypePairNode::accept(NodeVisitor &visitor) {
   NodeVisitor &nuVisitor = visitor.visit(*this);
   type.accept(nuVisitor);
 }
+
+std::string VariableRefNode::getQualifiedIdent() {
+  std::string qualified = localIdent;
+  NamespaceNode *current = &refNamespace;
+  while (current != nullptr && !current->getIdent().empty()) {
+    qualified = current->getIdent() + "." + qualified;
+    current = current->getParentNamespace();
+  }
+  return qualified;
+}
@@ -47,6 +47,12 @@ class FunctionDefHeaderNode;
 class TypeRefNode;
 class StructTypePairNode;
 
+// Where a node starts in its source, counting from 1. Zero when unknown.
+struct SourceLocation {
+  int line = 0;
+  int column = 0;
+};
+
 // Abstract
 class Node {
 public:
@@ -63,6 +69,10 @@ public:
   FileNode(ExpressionNode &root): rootExpression(root) {}
   ~FileNode() {}
   void accept(NodeVisitor &visitor);
+
+  ExpressionNode &getRootExpression() {
+    return rootExpression;
+  }
 };
 
 // Abstract
@@ -87,6 +97,14 @@ public:
   ): functionExp(funcExp), arguments(args) {}
   ~FunctionCallNode() {}
   void accept(NodeVisitor &visitor);
+
+  ExpressionNode &getFunctionExp() {
+    return functionExp;
+  }
+
+  std::forward_list<ExpressionNode*> &getArguments() {
+    return arguments;
+  }
 };
 
 class NamespaceNode: public Node {
@@ -107,6 +125,10 @@ public:
   std::string &getIdent() {
     return ident;
   }
+
+  NamespaceNode *getParentNamespace() {
+    return parentNamespace;
+  }
 };
 
 class VariableRefNode: public ExpressionNode {
@@ -125,11 +147,19 @@ public:
   const std::string &getLocalIdent() {
     return localIdent;
   }
+
+  NamespaceNode &getNamespace() {
+    return refNamespace;
+  }
+
+  // The identifier including its namespace path, e.g. `Test.ff`.
+  std::string getQualifiedIdent();
 };
 
 class LambdaFunctionNode: public ExpressionNode {
   std::forward_list<FunctionParamNode*> &params;
   ExpressionNode &expression;
+  SourceLocation location;
 
 public:
   NodeType getType() { return NodeType::LambdaFunction; }
@@ -139,6 +169,18 @@ public:
   ): params(paramList), expression(exp) {}
   ~LambdaFunctionNode() {}
   void accept(NodeVisitor &visitor);
+
+  SourceLocation &getLocation() {
+    return location;
+  }
+
+  std::forward_list<FunctionParamNode*> &getParams() {
+    return params;
+  }
+
+  ExpressionNode &getExpression() {
+    return expression;
+  }
 };
 
 class ElvisNode: public ExpressionNode {
@@ -151,6 +193,14 @@ public:
     expressionA(expA), expressionB(expB) {}
   ~ElvisNode() {}
   void accept(NodeVisitor &visitor);
+
+  ExpressionNode &getExpressionA() {
+    return expressionA;
+  }
+
+  ExpressionNode &getExpressionB() {
+    return expressionB;
+  }
 };
 
 class BlockNode: public ExpressionNode {
@@ -163,6 +213,14 @@ public:
     definition(def), expression(exp) {}
   ~BlockNode() {}
   void accept(NodeVisitor &visitor);
+
+  DefinitionNode &getDefinition() {
+    return definition;
+  }
+
+  ExpressionNode &getExpression() {
+    return expression;
+  }
 };
 
 class NumberNode: public LiteralNode {
@@ -173,6 +231,10 @@ public:
   NumberNode(const double value): val(value) {}
   ~NumberNode() {}
   void accept(NodeVisitor &visitor);
+
+  double getValue() {
+    return val;
+  }
 };
 
 class StringNode: public LiteralNode {
@@ -183,6 +245,10 @@ public:
   StringNode(std::string &value): val(value) {}
   ~StringNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::string &getValue() {
+    return val;
+  }
 };
 
 class AtomNode: public LiteralNode {
@@ -193,6 +259,10 @@ public:
   AtomNode(std::string &value): val(value) {}
   ~AtomNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::string &getValue() {
+    return val;
+  }
 };
 
 class TupleNode: public LiteralNode {
@@ -205,6 +275,10 @@ public:
   TupleNode(): expressionList(*new std::forward_list<ExpressionNode*>()) {}
   ~TupleNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::forward_list<ExpressionNode*> &getExpressionList() {
+    return expressionList;
+  }
 };
 
 class ListNode: public LiteralNode {
@@ -217,6 +291,10 @@ public:
   ListNode(): expressionList(*new std::forward_list<ExpressionNode*>()) {}
   ~ListNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::forward_list<ExpressionNode*> &getExpressionList() {
+    return expressionList;
+  }
 };
 
 class StructNode: public LiteralNode {
@@ -228,6 +306,10 @@ public:
     structPairList(value) {}
   ~StructNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::forward_list<StructPairNode*> &getStructPairList() {
+    return structPairList;
+  }
 };
 
 class StructPairNode: public Node {
@@ -240,6 +322,14 @@ public:
     ident(identVal), expression(expVal) {}
   ~StructPairNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::string &getIdent() {
+    return ident;
+  }
+
+  ExpressionNode &getExpression() {
+    return expression;
+  }
 };
 
 // Abstract
@@ -263,12 +353,21 @@ public:
       expression(exp) {}
   ~VariableDefNode() {}
   void accept(NodeVisitor &visitor);
+
+  VariableRefNode &getVariableRef() {
+    return variableRef;
+  }
+
+  ExpressionNode &getExpression() {
+    return expression;
+  }
 };
 
 class FunctionDefNode: public DefinitionNode {
   FunctionDefHeaderNode &header;
   std::forward_list<FunctionParamNode*> &params;
   ExpressionNode &expression;
+  SourceLocation location;
 
 public:
   NodeType getType() { return NodeType::FunctionDef; }
@@ -281,6 +380,22 @@ public:
       expression(exp) {}
   ~FunctionDefNode() {}
   void accept(NodeVisitor &visitor);
+
+  SourceLocation &getLocation() {
+    return location;
+  }
+
+  FunctionDefHeaderNode &getHeader() {
+    return header;
+  }
+
+  std::forward_list<FunctionParamNode*> &getParams() {
+    return params;
+  }
+
+  ExpressionNode &getExpression() {
+    return expression;
+  }
 };
 
 class TypeDefNode: public DefinitionNode {
@@ -305,6 +420,10 @@ public:
     variableRef(varRef), variableType(varType) {}
   ~FunctionDefHeaderNode() {}
   void accept(NodeVisitor &visitor);
+
+  VariableRefNode &getVariableRef() {
+    return variableRef;
+  }
 };
 
 class FunctionParamNode: public Node {
@@ -317,6 +436,10 @@ public:
     name(paramName), paramType(parameterType) {}
   ~FunctionParamNode() {}
   void accept(NodeVisitor &visitor);
+
+  std::string &getName() {
+    return name;
+  }
 };
 
 // Abstract
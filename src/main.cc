@@ -1,54 +1,145 @@
+#include "ModuleLoader.hh"
 #include "ast/Node.hh"
 #include "ast/PrintVisitor.hh"
-#include "../generated/Parser.hh"
-#include "../generated/Lexer.hh"
+#include "vm/AtomTable.hh"
+#include "vm/Bench.hh"
+#include "vm/Compiler.hh"
+#include "vm/Errors.hh"
+#include "vm/Object.hh"
+#include "vm/Profiler.hh"
+#include "vm/TreeWalker.hh"
+#include "vm/VM.hh"
 
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
-int yyparse(FileNode** rootNode, yyscan_t scanner);
-
-FileNode* getAst(const char* programText) {
-  FileNode *rootNode;
-  yyscan_t scanner;
-  YY_BUFFER_STATE state;
+// Usage:
+//   lush [--run | --tree | --disassemble | --closures | --bench [iterations]
+//        | --gc-stress | --modules | --profile [file]] [--atoms file]
+//   lush --bench-lists [length]
+// Reads a program from stdin, along with the modules it imports, which are
+// found relative to the working directory. With no flag the AST is printed.
+// `--modules` reports how long loading took. `--profile` runs the program with
+// every function instrumented, prints where its time went and writes folded
+// stacks for flame graph tools to `file`, `lush.folded` by default. `--atoms`
+// loads the atom table from `file` before compiling and saves it back after,
+// so programs compiled one at a time share atom IDs.
+int main(int argc, char **argv) {
+  std::string name;
+  const char *atomsPath = nullptr;
 
-  if (yylex_init(&scanner)) {
-    return NULL;
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    if (std::strcmp(argv[i], "--atoms") == 0 && i + 1 < argc) {
+      atomsPath = argv[++i];
+    } else {
+      args.push_back(argv[i]);
+    }
   }
-  //printf("yylex_init\n");
+  argc = args.size();
+  argv = args.data();
 
-  state = yy_scan_string(programText, scanner);
-  //printf("yy_scan_string\n");
-
-  if (yyparse(&rootNode, scanner)) {
-    return NULL;
+  int iterations = 10;
+  if (argc > 2 && std::strcmp(argv[1], "--bench") == 0) {
+    iterations = std::atoi(argv[2]);
+    if (iterations < 1) {
+      std::cerr << "Error: --bench needs at least 1 iteration\n";
+      return 1;
+    }
   }
-  //printf("yyparse\n");
-
-  yy_delete_buffer(state, scanner);
-  //printf("yy_delete_buffer\n");
 
-  yylex_destroy(scanner);
-  //printf("yylex_destroy\n");
-
-  return rootNode;
-}
-
-int main() {
-  std::string name;
+  if (argc > 1 && std::strcmp(argv[1], "--bench-lists") == 0) {
+    FileNode *increment = getAst("(\\x Num = (add x 1))");
+    runListBenchmark(*increment, argc > 2 ? std::atol(argv[2]) : 1000000,
+      std::cout);
+    return 0;
+  }
 
   std::getline(std::cin, name, '\0');
 
   //printf("<input>\n%s\n</input>", name.c_str());
 
   //yydebug = 1;
-  FileNode* node = getAst(name.c_str());
-  //printf("getAst\n");
+  ModuleLoader loader;
+  FileNode* node;
+  try {
+    node = loader.loadProgram(name, ".");
+  } catch (LoadError &err) {
+    std::cerr << "Error: " << err.what() << "\n";
+    return 1;
+  }
+
+  const char *mode = argc > 1 ? argv[1] : "";
+
+  if (atomsPath != nullptr) {
+    std::ifstream atomsIn(atomsPath);
+    AtomTable::program().load(atomsIn);
+  }
+
+  try {
+    if (std::strcmp(mode, "--run") == 0) {
+      Compiler compiler;
+      Proto *main = compiler.compile(*node);
+      VM vm;
+      std::cout << showValue(vm.execute(*main)) << "\n";
+    } else if (std::strcmp(mode, "--profile") == 0) {
+      const char *foldedPath = argc > 2 ? argv[2] : "lush.folded";
+      Compiler compiler;
+      compiler.setProfiling(true);
+      Proto *main = compiler.compile(*node);
+      VM vm;
+      std::cout << showValue(vm.execute(*main)) << "\n";
+      Profiler::printReport(std::cout);
+      std::ofstream folded(foldedPath);
+      Profiler::writeFoldedStacks(folded);
+      std::cout << "folded stacks:    " << foldedPath << "\n";
+    } else if (std::strcmp(mode, "--tree") == 0) {
+      TreeWalker walker;
+      std::cout << showValue(walker.execute(*node)) << "\n";
+    } else if (std::strcmp(mode, "--disassemble") == 0) {
+      Compiler compiler;
+      std::cout << compiler.compile(*node)->disassemble();
+      std::cout << "strings (" << compiler.getStrings().size() << " bytes)\n";
+      compiler.getStrings().list(std::cout);
+      std::cout << "atoms\n";
+      for (size_t i = 0; i < AtomTable::program().size(); i++) {
+        std::cout << "  " << i << "\t:" << AtomTable::program().name(i)
+          << "\n";
+      }
+    } else if (std::strcmp(mode, "--closures") == 0) {
+      Compiler compiler;
+      compiler.compile(*node);
+      const ClosureStats &stats = compiler.getClosureStats();
+      std::cout << "lifted (environment in registers): " << stats.lifted
+        << "\nconstant (no environment): " << stats.constant
+        << "\nheap (flat environment): " << stats.heap << "\n";
+    } else if (std::strcmp(mode, "--bench") == 0) {
+      runBenchmark(*node, iterations, std::cout);
+    } else if (std::strcmp(mode, "--gc-stress") == 0) {
+      if (!runGcStress(*node, std::cout)) {
+        return 1;
+      }
+    } else if (std::strcmp(mode, "--modules") == 0) {
+      loader.printReport(std::cout);
+    } else {
+      PrintVisitor printVisitor;
+      node->accept(printVisitor);
+      std::cout << printVisitor.to_string();
+    }
+  } catch (std::runtime_error &err) {
+    std::cerr << "Error: " << err.what() << "\n";
+    return 1;
+  }
 
-  PrintVisitor printVisitor;
-  node->accept(printVisitor);
-  std::cout << printVisitor.to_string();
+  if (atomsPath != nullptr) {
+    std::ofstream atomsOut(atomsPath);
+    AtomTable::program().save(atomsOut);
+  }
 
   return 0;
 }
@@ -0,0 +1,32 @@
+#include "AtomTable.hh"
+
+AtomTable &AtomTable::program() {
+  static AtomTable table;
+  return table;
+}
+
+uint32_t AtomTable::intern(const std::string &name) {
+  auto found = ids.find(name);
+  if (found != ids.end()) {
+    return found->second;
+  }
+  uint32_t id = names.size();
+  names.push_back(name);
+  ids[name] = id;
+  return id;
+}
+
+void AtomTable::load(std::istream &in) {
+  std::string name;
+  while (std::getline(in, name)) {
+    if (!name.empty()) {
+      intern(name);
+    }
+  }
+}
+
+void AtomTable::save(std::ostream &out) const {
+  for (const std::string &name : names) {
+    out << name << "\n";
+  }
+}
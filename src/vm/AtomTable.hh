@@ -0,0 +1,35 @@
+#ifndef SRC_VM_ATOM_TABLE_HH
+#define SRC_VM_ATOM_TABLE_HH
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Assigns every distinct atom in a program a dense integer ID, so atoms (and
+// struct field names, which share the table) compare as integers at runtime.
+// IDs are handed out in first-seen order and never change, so modules
+// compiled separately against the same saved table agree on them.
+class AtomTable {
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> ids;
+
+public:
+  AtomTable() {}
+  ~AtomTable() {}
+
+  // The table shared by everything compiled or run in this process.
+  static AtomTable &program();
+
+  uint32_t intern(const std::string &name);
+  const std::string &name(uint32_t id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+
+  // One atom per line, in ID order. Loading only adds atoms that are new.
+  void load(std::istream &in);
+  void save(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "Bench.hh"
+#include "Compiler.hh"
+#include "Errors.hh"
+#include "Heap.hh"
+#include "Object.hh"
+#include "TreeWalker.hh"
+#include "VM.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+    .count();
+}
+
+// For collecting once nothing in the heap is needed any more.
+class NoRoots: public RootSet {
+public:
+  void traceRoots(Heap &heap) {}
+};
+
+void runBenchmark(FileNode &file, int iterations, std::ostream &out) {
+  Clock::time_point compileStart = Clock::now();
+  Compiler compiler;
+  Proto *main = compiler.compile(file);
+  double compileMillis = millisSince(compileStart);
+
+  VM vm;
+  Value vmResult;
+  Clock::time_point vmStart = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    vmResult = vm.execute(*main);
+  }
+  double vmMillis = millisSince(vmStart);
+  // Taken now, since the tree walker allocates in the same heap.
+  std::ostringstream heapReport;
+  Heap::current().printStats(heapReport);
+
+  // The tree walker recurses on the C++ stack, so programs that go deep can
+  // only be timed on the VM.
+  TreeWalker walker;
+  Value treeResult;
+  std::string treeSkipped;
+  Clock::time_point treeStart = Clock::now();
+  try {
+    for (int i = 0; i < iterations; i++) {
+      treeResult = walker.execute(file);
+    }
+  } catch (StackOverflowError &err) {
+    treeSkipped = err.what();
+  }
+  double treeMillis = millisSince(treeStart);
+
+  // The VM's result is only valid until it next runs.
+  out << "result:       " << showValue(vmResult) << "\n";
+  if (treeSkipped.empty() && !valuesEqual(vmResult, treeResult)) {
+    out << "MISMATCH:     tree walker returned " << showValue(treeResult)
+      << "\n";
+  }
+
+  // The profiler rewrites the code of functions it stops timing, so every
+  // profiled run gets a fresh copy. Its overhead is measured against plain
+  // runs alternating with it, each starting from an empty nursery, so that
+  // neither pays for collecting the other's garbage. Nothing from earlier
+  // runs is used again, and only the running program's constants are roots,
+  // so each copy is compiled after that collection, outside the timing.
+  NoRoots noRoots;
+  auto timeRun = [&](bool profiling) {
+    Heap::current().collect(noRoots);
+    Compiler copyCompiler;
+    copyCompiler.setProfiling(profiling);
+    Proto *copy = copyCompiler.compile(file);
+    Clock::time_point start = Clock::now();
+    vm.execute(*copy);
+    return millisSince(start);
+  };
+  double coldMillis = 0;
+  double profiledMillis = 0;
+  std::vector<double> ratios;
+  for (int i = 0; i < iterations; i++) {
+    double plain;
+    double profiled;
+    if (i % 2 == 0) {
+      plain = timeRun(false);
+      profiled = timeRun(true);
+    } else {
+      profiled = timeRun(true);
+      plain = timeRun(false);
+    }
+    coldMillis += plain;
+    profiledMillis += profiled;
+    ratios.push_back(profiled / plain);
+  }
+  // The median pair, since a run that happens to hold a major collection is
+  // far slower than the other.
+  std::sort(ratios.begin(), ratios.end());
+  double overhead = ratios.empty() ? 0 : ratios[ratios.size() / 2] - 1;
+
+  out << "iterations:   " << iterations << "\n";
+  out << "compile:      " << compileMillis << " ms\n";
+  out << "vm:           " << vmMillis / iterations << " ms/iteration\n";
+  if (treeSkipped.empty()) {
+    out << "tree walker:  " << treeMillis / iterations << " ms/iteration\n";
+    out << "speedup:      " << treeMillis / vmMillis << "x\n";
+  } else {
+    out << "tree walker:  skipped, " << treeSkipped << "\n";
+  }
+  out << "cold vm:      " << coldMillis / iterations
+    << " ms/iteration (fresh copy, empty nursery)\n";
+  out << "profiled vm:  " << profiledMillis / iterations
+    << " ms/iteration (" << 100 * overhead
+    << "% overhead, median of paired cold runs)\n";
+  out << "vm heap:\n" << heapReport.str();
+}
+
+bool runGcStress(FileNode &file, std::ostream &out) {
+  Compiler compiler;
+  Proto *main = compiler.compile(file);
+
+  VM vm;
+  Heap::current().setStress(true);
+  Value vmResult = vm.execute(*main);
+  Heap::current().setStress(false);
+  std::ostringstream heapReport;
+  Heap::current().printStats(heapReport);
+
+  out << "result:       " << showValue(vmResult) << "\n";
+  bool matches = true;
+  TreeWalker walker;
+  try {
+    Value treeResult = walker.execute(file);
+    matches = valuesEqual(vmResult, treeResult);
+    if (!matches) {
+      out << "MISMATCH:     tree walker returned " << showValue(treeResult)
+        << "\n";
+    }
+  } catch (StackOverflowError &err) {
+    out << "tree walker:  skipped, " << err.what() << "\n";
+  }
+  out << heapReport.str();
+  return matches;
+}
+
+// The baseline for `runListBenchmark`: a singly linked list of values, laid
+// out the way the AST's `std::forward_list`s are.
+struct ConsCell {
+  Value head;
+  ConsCell *tail;
+};
+
+static ConsCell *consFromRange(size_t length) {
+  ConsCell *list = nullptr;
+  for (size_t i = length; i > 0; i--) {
+    list = new ConsCell{ Value::number(i - 1), list };
+  }
+  return list;
+}
+
+// Calls `fn` through the VM, as `map` does. Nothing it returns is kept, since
+// the cells hold numbers and live outside the heap.
+static ConsCell *consMap(VM &vm, Value &fn, ConsCell *list) {
+  ConsCell *result = nullptr;
+  ConsCell **next = &result;
+  for (; list != nullptr; list = list->tail) {
+    Value element = list->head;
+    *next = new ConsCell{ vm.call(fn, &element, 1), nullptr };
+    next = &(*next)->tail;
+  }
+  return result;
+}
+
+static double consSum(ConsCell *list) {
+  double sum = 0;
+  for (; list != nullptr; list = list->tail) {
+    sum += list->head.asNumber();
+  }
+  return sum;
+}
+
+static ConsCell *consConcat(ConsCell *a, ConsCell *b) {
+  ConsCell *result = b;
+  ConsCell **next = &result;
+  for (; a != nullptr; a = a->tail) {
+    *next = new ConsCell{ a->head, b };
+    next = &(*next)->tail;
+  }
+  return result;
+}
+
+static Value callBuiltin(VM &vm, const char *name, Value *args, int argCount) {
+  return vm.call(Value::builtin(findBuiltin(name)), args, argCount);
+}
+
+static Value listSum(VM &vm, Value list) {
+  Value args[3] = {
+    Value::builtin(findBuiltin("add")), Value::number(0), list
+  };
+  return callBuiltin(vm, "fold", args, 3);
+}
+
+static void reportThroughput(
+  std::ostream &out,
+  const char *operation,
+  size_t length,
+  double listMillis,
+  double consMillis
+) {
+  double elementsPerMicro = length / (listMillis * 1000);
+  out << operation << ": list " << elementsPerMicro << " elements/us, "
+    << "cons " << length / (consMillis * 1000) << " elements/us ("
+    << consMillis / listMillis << "x)\n";
+}
+
+void runListBenchmark(FileNode &increment, size_t length, std::ostream &out) {
+  Compiler compiler;
+  Proto *main = compiler.compile(increment);
+  VM vm;
+  // The function, then the lists as they are built. Each phase starts from
+  // an empty nursery, so none pays for collecting another's garbage.
+  Value values[4] = { vm.execute(*main) };
+  Value &fn = values[0];
+  Value &list = values[1];
+  Value &mapped = values[2];
+  Value &joined = values[3];
+  ScopedRoots rootValues(values, 4);
+
+  vm.collectGarbage();
+  Clock::time_point start = Clock::now();
+  Value count = Value::number(length);
+  list = callBuiltin(vm, "range", &count, 1);
+  double listBuild = millisSince(start);
+  start = Clock::now();
+  ConsCell *cons = consFromRange(length);
+  double consBuild = millisSince(start);
+
+  vm.collectGarbage();
+  start = Clock::now();
+  Value mapArgs[2] = { fn, list };
+  mapped = callBuiltin(vm, "map", mapArgs, 2);
+  double listMap = millisSince(start);
+  start = Clock::now();
+  ConsCell *consMapped = consMap(vm, fn, cons);
+  double consMapMillis = millisSince(start);
+
+  vm.collectGarbage();
+  start = Clock::now();
+  Value listTotal = listSum(vm, mapped);
+  double listFold = millisSince(start);
+  start = Clock::now();
+  double consTotal = consSum(consMapped);
+  double consFold = millisSince(start);
+
+  vm.collectGarbage();
+  start = Clock::now();
+  Value concatArgs[2] = { list, mapped };
+  joined = callBuiltin(vm, "concat", concatArgs, 2);
+  double listConcatMillis = millisSince(start);
+  start = Clock::now();
+  ConsCell *consJoined = consConcat(cons, consMapped);
+  double consConcatMillis = millisSince(start);
+
+  if (listTotal.asNumber() != consTotal
+      || listSum(vm, joined).asNumber() != consSum(consJoined)) {
+    out << "MISMATCH: list and cons results differ\n";
+  }
+  out << "length: " << length << "\n";
+  reportThroughput(out, "build ", length, listBuild, consBuild);
+  reportThroughput(out, "map   ", length, listMap, consMapMillis);
+  reportThroughput(out, "fold  ", length, listFold, consFold);
+  reportThroughput(out, "concat", length, listConcatMillis, consConcatMillis);
+}
@@ -0,0 +1,26 @@
+#ifndef SRC_VM_BENCH_HH
+#define SRC_VM_BENCH_HH
+
+#include "../ast/Node.hh"
+
+#include <ostream>
+
+// Times compiling and running `file` on the bytecode VM against evaluating it
+// with the tree walker, `iterations` times each, and writes a report to `out`.
+// The tree walker is left out if the program recurses too deeply for it.
+// Also times the VM with profiling compiled in, to measure its overhead.
+void runBenchmark(FileNode &file, int iterations, std::ostream &out);
+
+// Runs `file` on the VM with a collection at every safepoint, checks the
+// result against the tree walker's and writes the heap statistics to `out`.
+// The check is skipped if the program recurses too deeply for the walker.
+// Meant for the allocation-heavy programs in `lush-files/bench`.
+bool runGcStress(FileNode &file, std::ostream &out);
+
+// Measures build, map, fold and concat throughput over `length` numbers for
+// the chunked list runtime against a cons-list baseline. The list side calls
+// the `range`, `map`, `fold` and `concat` builtins through the VM, mapping
+// the function that `increment` evaluates to.
+void runListBenchmark(FileNode &increment, size_t length, std::ostream &out);
+
+#endif
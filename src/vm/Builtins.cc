@@ -0,0 +1,295 @@
+#include "Builtins.hh"
+#include "AtomTable.hh"
+#include "Errors.hh"
+#include "List.hh"
+#include "Object.hh"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+static double expectNumber(Value value, const char *builtinName) {
+  if (!value.isNumber()) {
+    throw RuntimeError(std::string(builtinName) + " expects a number, got "
+      + showValue(value));
+  }
+  return value.asNumber();
+}
+
+static ListObj *expectList(Value value, const char *builtinName) {
+  if (!isObjType(value, ObjType::List)) {
+    throw RuntimeError(std::string(builtinName) + " expects a list, got "
+      + showValue(value));
+  }
+  return static_cast<ListObj*>(value.asObject());
+}
+
+static Value builtinAdd(Evaluator &eval, Value *args) {
+  return Value::number(expectNumber(args[0], "add")
+    + expectNumber(args[1], "add"));
+}
+
+static Value builtinSub(Evaluator &eval, Value *args) {
+  return Value::number(expectNumber(args[0], "sub")
+    - expectNumber(args[1], "sub"));
+}
+
+static Value builtinMul(Evaluator &eval, Value *args) {
+  return Value::number(expectNumber(args[0], "mul")
+    * expectNumber(args[1], "mul"));
+}
+
+static Value builtinDiv(Evaluator &eval, Value *args) {
+  return Value::number(expectNumber(args[0], "div")
+    / expectNumber(args[1], "div"));
+}
+
+static Value builtinMod(Evaluator &eval, Value *args) {
+  return Value::number(std::fmod(expectNumber(args[0], "mod"),
+    expectNumber(args[1], "mod")));
+}
+
+static Value builtinLt(Evaluator &eval, Value *args) {
+  return Value::boolean(expectNumber(args[0], "lt")
+    < expectNumber(args[1], "lt"));
+}
+
+static Value builtinEq(Evaluator &eval, Value *args) {
+  return Value::boolean(valuesEqual(args[0], args[1]));
+}
+
+static Value builtinNot(Evaluator &eval, Value *args) {
+  return Value::boolean(!isTruthy(args[0]));
+}
+
+// `when cond x` is `some x` if `cond` holds and `nothing` otherwise. Paired
+// with `?:` it is Lush's conditional.
+static Value builtinWhen(Evaluator &eval, Value *args) {
+  return isTruthy(args[0]) ? Value::some(args[1]) : Value::nothing();
+}
+
+static Value builtinSome(Evaluator &eval, Value *args) {
+  return Value::some(args[0]);
+}
+
+// Prepending copies the list; `push` is the cheap way to grow one.
+static Value builtinCons(Evaluator &eval, Value *args) {
+  ListBuilder builder;
+  builder.add(args[0]);
+  builder.addAll(expectList(args[1], "cons"));
+  return Value::object(builder.build());
+}
+
+static Value builtinPush(Evaluator &eval, Value *args) {
+  return Value::object(expectList(args[0], "push")->push(args[1]));
+}
+
+static Value builtinHead(Evaluator &eval, Value *args) {
+  ListObj *list = expectList(args[0], "head");
+  return list->isEmpty() ? Value::nothing() : Value::some(list->front());
+}
+
+static Value builtinTail(Evaluator &eval, Value *args) {
+  return Value::object(expectList(args[0], "tail")->rest());
+}
+
+static Value builtinNth(Evaluator &eval, Value *args) {
+  ListObj *list = expectList(args[0], "nth");
+  double index = expectNumber(args[1], "nth");
+  if (index < 0 || index >= list->size() || index != size_t(index)) {
+    return Value::nothing();
+  }
+  return Value::some(list->get(size_t(index)));
+}
+
+static Value builtinLength(Evaluator &eval, Value *args) {
+  if (isObjType(args[0], ObjType::String)) {
+    StringObj *str = static_cast<StringObj*>(args[0].asObject());
+    return Value::number(str->size());
+  }
+  return Value::number(expectList(args[0], "length")->size());
+}
+
+static Value builtinRange(Evaluator &eval, Value *args) {
+  double count = expectNumber(args[0], "range");
+  ListBuilder builder;
+  for (double i = 0; i < count; i++) {
+    builder.add(Value::number(i));
+  }
+  return Value::object(builder.build());
+}
+
+static Value builtinConcat(Evaluator &eval, Value *args) {
+  if (isObjType(args[0], ObjType::String)
+      && isObjType(args[1], ObjType::String)) {
+    StringObj *strA = static_cast<StringObj*>(args[0].asObject());
+    StringObj *strB = static_cast<StringObj*>(args[1].asObject());
+    return Value::object(new StringObj(strA->str() + strB->str()));
+  }
+
+  // Keeps the first list's trie and streams the second one's chunks onto it.
+  ListBuilder builder(expectList(args[0], "concat"));
+  builder.addAll(expectList(args[1], "concat"));
+  return Value::object(builder.build());
+}
+
+// Each call may collect and move the list, so elements are fetched through
+// `args` afresh and the results are kept rooted until the end.
+static Value builtinMap(Evaluator &eval, Value *args) {
+  size_t count = expectList(args[1], "map")->size();
+  std::vector<Value> results(count);
+  ScopedRoots rootResults(results.data(), count);
+  for (size_t i = 0; i < count; i++) {
+    Value element = static_cast<ListObj*>(args[1].asObject())->get(i);
+    results[i] = eval.call(args[0], &element, 1);
+  }
+
+  ListBuilder builder;
+  builder.addChunk(results.data(), results.size());
+  return Value::object(builder.build());
+}
+
+// Folds a chunk of numbers with a builtin arithmetic function without going
+// through `Evaluator::call`. Returns how many values were folded, which is
+// less than `count` if a non-number turns up.
+template <typename Op>
+static size_t foldNumbers(double &acc, const Value *values, size_t count,
+    Op op) {
+  size_t i = 0;
+  for (; i < count && values[i].isNumber(); i++) {
+    acc = op(acc, values[i].asNumber());
+  }
+  return i;
+}
+
+// The accumulator lives in `args[1]`, where a collection during a call can
+// update it, and elements are fetched through `args` for the same reason.
+static Value builtinFold(Evaluator &eval, Value *args) {
+  static const int addIndex = findBuiltin("add");
+  static const int mulIndex = findBuiltin("mul");
+  bool isAdd = args[0].isBuiltin() && args[0].asBuiltin() == addIndex;
+  bool isMul = args[0].isBuiltin() && args[0].asBuiltin() == mulIndex;
+  ListObj *list = expectList(args[2], "fold");
+  size_t count = list->size();
+
+  // Nothing is called while folding numbers, so the chunks stay put.
+  size_t i = 0;
+  if ((isAdd || isMul) && args[1].isNumber()) {
+    double num = args[1].asNumber();
+    bool numeric = true;
+    list->forEachChunk([&](const Value *values, size_t chunkCount) {
+      if (!numeric) {
+        return;
+      }
+      size_t folded = isAdd
+        ? foldNumbers(num, values, chunkCount,
+            [](double a, double b) { return a + b; })
+        : foldNumbers(num, values, chunkCount,
+            [](double a, double b) { return a * b; });
+      i += folded;
+      numeric = folded == chunkCount;
+    });
+    args[1] = Value::number(num);
+  }
+
+  for (; i < count; i++) {
+    Value callArgs[2] = {
+      args[1],
+      static_cast<ListObj*>(args[2].asObject())->get(i)
+    };
+    args[1] = eval.call(args[0], callArgs, 2);
+  }
+  return args[1];
+}
+
+static StructObj *expectStruct(Value value, const char *builtinName) {
+  if (!isObjType(value, ObjType::Struct)) {
+    throw RuntimeError(std::string(builtinName) + " expects a struct, got "
+      + showValue(value));
+  }
+  return static_cast<StructObj*>(value.asObject());
+}
+
+// `get :field struct`
+static Value builtinGet(Evaluator &eval, Value *args) {
+  StructObj *obj = expectStruct(args[1], "get");
+  if (!args[0].isAtom()) {
+    throw RuntimeError("get expects an atom, got " + showValue(args[0]));
+  }
+  Value field = obj->field(args[0].asAtom());
+  if (field.isNothing()) {
+    throw RuntimeError("struct has no field "
+      + AtomTable::program().name(args[0].asAtom()));
+  }
+  return field.unwrap();
+}
+
+// `match :tag struct` is `some` of the field named by the atom, or `nothing`
+// if there is none or the tag is not an atom. The compilers turn calls with a
+// literal struct into a jump table that evaluates only the chosen field.
+static Value builtinMatch(Evaluator &eval, Value *args) {
+  StructObj *obj = expectStruct(args[1], "match");
+  return args[0].isAtom() ? obj->field(args[0].asAtom()) : Value::nothing();
+}
+
+static Value builtinPrint(Evaluator &eval, Value *args) {
+  std::cout << showValue(args[0]) << "\n";
+  return args[0];
+}
+
+static const Builtin builtins[] = {
+  { "add", 2, builtinAdd },
+  { "sub", 2, builtinSub },
+  { "mul", 2, builtinMul },
+  { "div", 2, builtinDiv },
+  { "mod", 2, builtinMod },
+  { "lt", 2, builtinLt },
+  { "eq", 2, builtinEq },
+  { "not", 1, builtinNot },
+  { "when", 2, builtinWhen },
+  { "some", 1, builtinSome },
+  { "cons", 2, builtinCons },
+  { "push", 2, builtinPush },
+  { "head", 1, builtinHead },
+  { "tail", 1, builtinTail },
+  { "nth", 2, builtinNth },
+  { "length", 1, builtinLength },
+  { "range", 1, builtinRange },
+  { "concat", 2, builtinConcat },
+  { "append", 2, builtinConcat },
+  { "map", 2, builtinMap },
+  { "fold", 3, builtinFold },
+  { "get", 2, builtinGet },
+  { "match", 2, builtinMatch },
+  { "print", 1, builtinPrint }
+};
+
+static const int builtinCount = sizeof(builtins) / sizeof(builtins[0]);
+
+int findBuiltin(const std::string &name) {
+  for (int i = 0; i < builtinCount; i++) {
+    if (name == builtins[i].name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const Builtin &getBuiltin(int index) {
+  return builtins[index];
+}
+
+bool findBuiltinConstant(const std::string &name, Value &out) {
+  if (name == "nothing") {
+    out = Value::nothing();
+  } else if (name == "true") {
+    out = Value::boolean(true);
+  } else if (name == "false") {
+    out = Value::boolean(false);
+  } else if (name == "unit") {
+    out = Value::unit();
+  } else {
+    return false;
+  }
+  return true;
+}
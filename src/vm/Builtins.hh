@@ -0,0 +1,34 @@
+#ifndef SRC_VM_BUILTINS_HH
+#define SRC_VM_BUILTINS_HH
+
+#include "./Value.hh"
+
+#include <string>
+
+// Anything that can apply a Lush function value to arguments. Builtins such
+// as `map` call back into whichever evaluator invoked them.
+//
+// A call may collect garbage. `args` are roots and are updated if what they
+// point at moves, but a builtin that keeps other objects across a call must
+// root them with a `ScopedRoots`, and must not hold pointers into them.
+class Evaluator {
+public:
+  virtual Value call(Value callee, Value *args, int argCount) = 0;
+};
+
+typedef Value (*BuiltinFn)(Evaluator &eval, Value *args);
+
+struct Builtin {
+  const char *name;
+  int arity;
+  BuiltinFn fn;
+};
+
+// Returns the index of the builtin function called `name`, or -1.
+int findBuiltin(const std::string &name);
+const Builtin &getBuiltin(int index);
+
+// Looks up builtin constants such as `nothing` and `true`.
+bool findBuiltinConstant(const std::string &name, Value &out);
+
+#endif
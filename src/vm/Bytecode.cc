@@ -0,0 +1,100 @@
+#include "Bytecode.hh"
+#include "AtomTable.hh"
+#include "Object.hh"
+
+#include <algorithm>
+#include <sstream>
+
+const char *opName(Op op) {
+  #define LUSH_OPCODE_NAME(name) #name,
+  static const char *names[] = {
+    LUSH_OPCODES(LUSH_OPCODE_NAME)
+  };
+  #undef LUSH_OPCODE_NAME
+  return names[int(op)];
+}
+
+int Proto::liveRegisters(int returnPc) const {
+  auto entry = std::lower_bound(stackMap.begin(), stackMap.end(), returnPc,
+    [](const StackMapEntry &entry, int pc) { return entry.returnPc < pc; });
+  if (entry == stackMap.end() || entry->returnPc != returnPc) {
+    return registerCount;
+  }
+  return entry->liveRegisters;
+}
+
+std::string Proto::disassemble() {
+  std::ostringstream out;
+  out << "proto " << name;
+  if (line > 0) {
+    out << " at " << line << ":" << column;
+  }
+  out << " (params " << paramCount << ", registers " << registerCount
+    << ", captures " << captures.size() << ")\n";
+
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    Instr instr = code[pc];
+    Op op = opOf(instr);
+    out << "  " << pc << "\t" << opName(op) << "\t";
+    switch (op) {
+    case Op::LoadK:
+      out << argA(instr) << " " << showValue(constants[argBx(instr)]);
+      break;
+    case Op::LoadBuiltin:
+    case Op::Closure:
+      out << argA(instr) << " " << argBx(instr);
+      break;
+    case Op::Elvis:
+      out << argA(instr) << " -> " << (int(pc) + 1 + argSBx(instr));
+      break;
+    case Op::Jump:
+      out << "-> " << (int(pc) + 1 + argSBx(instr));
+      break;
+    case Op::JumpIfNotAtom:
+      out << argA(instr) << " :" << AtomTable::program().name(code[pc + 1])
+        << " else -> " << (int(pc) + 2 + argSBx(instr));
+      pc++;
+      break;
+    case Op::Switch: {
+      SwitchTable &table = switchTables[argBx(instr)];
+      out << argA(instr);
+      for (size_t i = 0; i < table.targets.size(); i++) {
+        if (table.targets[i] != table.defaultTarget) {
+          out << " :" << AtomTable::program().name(table.minAtom + i)
+            << " -> " << table.targets[i];
+        }
+      }
+      out << " else -> " << table.defaultTarget;
+      break;
+    }
+    case Op::Some:
+    case Op::Exit:
+    case Op::Return:
+      out << argA(instr);
+      break;
+    case Op::Enter:
+    case Op::Count:
+      break;
+    case Op::CallDirect:
+      out << argA(instr) << " " << argB(instr) << " "
+        << callees[code[pc + 1]]->name;
+      pc++;
+      break;
+    case Op::Call:
+    case Op::MakeStruct:
+      out << argA(instr) << " " << argB(instr) << " " << argC(instr)
+        << " [" << code[pc + 1] << "]";
+      pc++;
+      break;
+    default:
+      out << argA(instr) << " " << argB(instr) << " " << argC(instr);
+      break;
+    }
+    out << "\n";
+  }
+
+  for (Proto *proto : protos) {
+    out << proto->disassemble();
+  }
+  return out.str();
+}
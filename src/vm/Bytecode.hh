@@ -0,0 +1,145 @@
+#ifndef SRC_VM_BYTECODE_HH
+#define SRC_VM_BYTECODE_HH
+
+#include "./Builtins.hh"
+#include "./Value.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Every instruction is a 32-bit word laid out either as `op a b c` (8 bits
+// each) or as `op a bx`, with a 16-bit `bx` that is biased when used as a
+// signed jump offset. A few instructions are followed by one extra word.
+typedef uint32_t Instr;
+
+// X-macro list of opcodes, so that the enum and the interpreter's dispatch
+// table can never disagree about the order.
+#define LUSH_OPCODES(X) \
+  X(LoadK)        /* R[a] = K[bx] */ \
+  X(LoadBuiltin)  /* R[a] = builtin bx */ \
+  X(Move)         /* R[a] = R[b] */ \
+  X(GetCapture)   /* R[a] = captures[b] */ \
+  X(Closure)      /* R[a] = closure over protos[bx] */ \
+  X(Call)         /* R[a] = R[a](R[a+1] .. R[a+b]); next word: cache slot */ \
+  X(CallDirect)   /* R[a] = callees[next word](R[a+1] .. R[a+b]) */ \
+  X(Elvis)        /* if R[a] is present, unwrap it and jump by sbx */ \
+  X(ElvisSelect)  /* R[a] = R[b] present ? unwrap(R[b]) : R[c] */ \
+  X(Some)         /* R[a] = some R[a] */ \
+  X(Jump)         /* jump by sbx */ \
+  X(Switch)       /* jump to switchTables[bx]'s target for atom R[a] */ \
+  X(JumpIfNotAtom) /* unless R[a] is atom (next word), jump by sbx */ \
+  X(MakeTuple)    /* R[a] = {R[b] .. R[b+c-1]} */ \
+  X(MakeList)     /* R[a] = [R[b] .. R[b+c-1]] */ \
+  X(MakeStruct)   /* R[a] = struct of R[b] .. R[b+c-1]; next word: shape */ \
+  X(Enter)        /* profiling: start timing this call */ \
+  X(Count)        /* profiling: count this call without timing it */ \
+  X(Exit)         /* profiling: stop timing a timed call, return R[a] */ \
+  X(Return)       /* return R[a] */
+
+#define LUSH_OPCODE_ENUM(name) name,
+enum class Op: uint8_t {
+  LUSH_OPCODES(LUSH_OPCODE_ENUM)
+};
+#undef LUSH_OPCODE_ENUM
+
+const int maxRegisters = 256;
+const int sbxBias = 0x7FFF;
+
+inline Instr encodeABC(Op op, int a, int b, int c) {
+  return uint32_t(op) | (uint32_t(a) << 8) | (uint32_t(b) << 16)
+    | (uint32_t(c) << 24);
+}
+
+inline Instr encodeABx(Op op, int a, int bx) {
+  return uint32_t(op) | (uint32_t(a) << 8) | (uint32_t(bx) << 16);
+}
+
+inline Op opOf(Instr instr) { return Op(instr & 0xFF); }
+inline int argA(Instr instr) { return (instr >> 8) & 0xFF; }
+inline int argB(Instr instr) { return (instr >> 16) & 0xFF; }
+inline int argC(Instr instr) { return (instr >> 24) & 0xFF; }
+inline int argBx(Instr instr) { return instr >> 16; }
+inline int argSBx(Instr instr) { return int(instr >> 16) - sbxBias; }
+
+const char *opName(Op op);
+
+class Proto;
+
+// Where a closure gets one of its captured values from when it is created:
+// a register of the enclosing function, one of the enclosing function's own
+// captures, or the new closure itself for a recursive function definition.
+enum class CaptureFrom {
+  Register,
+  Capture,
+  Self
+};
+
+struct Capture {
+  CaptureFrom from;
+  int index;
+};
+
+// Monomorphic inline cache for one call site. `calleeBits` is the raw value
+// that was last called there, so a hit skips the type and arity checks and
+// goes straight to either `proto` or `builtin`.
+struct CallCache {
+  uint64_t calleeBits = Value::sentinelBits();
+  Proto *proto = nullptr;
+  BuiltinFn builtin = nullptr;
+};
+
+// Jump table for a `match` on a literal struct whose case atoms are close
+// enough together. `targets[id - minAtom]` is
+// where the case for atom `id` starts; every other value goes to
+// `defaultTarget`.
+struct SwitchTable {
+  uint32_t minAtom;
+  std::vector<int> targets;
+  int defaultTarget;
+};
+
+// The registers a function still needs once a call it makes returns, which
+// is every register below `liveRegisters`. The collector only scans those.
+struct StackMapEntry {
+  // The instruction the call returns to.
+  int returnPc;
+  int liveRegisters;
+};
+
+// The compiled form of one function (or of the file's root expression).
+class Proto {
+public:
+  std::string name;
+  // Where the function starts in its source, or 0 for the root expression.
+  int line = 0;
+  int column = 0;
+  int paramCount = 0;
+  int registerCount = 0;
+  std::vector<Instr> code;
+  std::vector<Value> constants;
+  std::vector<Capture> captures;
+  std::vector<Proto*> protos;
+  // Lifted functions called directly from this one.
+  std::vector<Proto*> callees;
+  std::vector<CallCache> callCaches;
+  // Field names of each struct literal, as atom IDs.
+  std::vector<std::vector<uint32_t>> structShapes;
+  std::vector<SwitchTable> switchTables;
+  // One entry per call, in code order.
+  std::vector<StackMapEntry> stackMap;
+  // Set when compiled for profiling, which starts the code with `Enter` and
+  // ends it with `Exit`. Once calls are too short to be worth timing, the
+  // profiler rewrites the `Enter` to `Count`.
+  int profileId = -1;
+  bool untimed = false;
+
+  Proto(const std::string &protoName): name(protoName) {}
+
+  // The registers live while a call returning to `returnPc` runs.
+  int liveRegisters(int returnPc) const;
+
+  std::string disassemble();
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "ClosureConversion.hh"
+#include "Compiler.hh"
+
+#include <algorithm>
+
+ClosureConversion::FunctionInfo *ClosureConversion::newFunction(
+  FunctionInfo *parent,
+  Node *node
+) {
+  FunctionInfo *info = new FunctionInfo{ parent, node, {} };
+  functions.emplace_back(info);
+  if (node != nullptr) {
+    functionsByNode[node] = info;
+  }
+  return info;
+}
+
+ClosureConversion::Binding *ClosureConversion::bind(
+  const std::string &name,
+  FunctionInfo *owner
+) {
+  Binding *binding = new Binding{ name, owner, nullptr, false };
+  bindings.emplace_back(binding);
+  return binding;
+}
+
+void ClosureConversion::reference(
+  VariableRefNode &node,
+  FunctionInfo *site,
+  bool callee
+) {
+  std::string name = node.getQualifiedIdent();
+  for (auto it = scope.rbegin(); it != scope.rend(); ++it) {
+    if ((*it)->name == name) {
+      Binding *binding = *it;
+      // Using a function as anything but a callee lets it escape.
+      if (binding->function != nullptr && !callee) {
+        binding->escapes = true;
+      }
+      references.push_back({
+        binding,
+        site,
+        callee,
+        binding->function != nullptr ? scope : std::vector<Binding*>()
+      });
+      return;
+    }
+  }
+  // Anything else is a builtin, which never needs capturing.
+}
+
+void ClosureConversion::analyze(FileNode &file) {
+  FunctionInfo *root = newFunction(nullptr, nullptr);
+  visitExpression(file.getRootExpression(), root);
+
+  do {
+    computeFreeValues();
+  } while (findShadowedCalls());
+}
+
+void ClosureConversion::visitExpression(
+  ExpressionNode &node,
+  FunctionInfo *fn
+) {
+  switch (node.getType()) {
+  case NodeType::VariableRef:
+    reference(static_cast<VariableRefNode&>(node), fn, false);
+    break;
+  case NodeType::FunctionCall: {
+    FunctionCallNode &call = static_cast<FunctionCallNode&>(node);
+    ExpressionNode &callee = call.getFunctionExp();
+    if (callee.getType() == NodeType::VariableRef) {
+      reference(static_cast<VariableRefNode&>(callee), fn, true);
+    } else {
+      visitExpression(callee, fn);
+    }
+    for (ExpressionNode *arg : call.getArguments()) {
+      visitExpression(*arg, fn);
+    }
+    break;
+  }
+  case NodeType::LambdaFunction: {
+    LambdaFunctionNode &lambda = static_cast<LambdaFunctionNode&>(node);
+    visitFunction(
+      newFunction(fn, &lambda),
+      lambda.getParams(),
+      lambda.getExpression()
+    );
+    break;
+  }
+  case NodeType::Elvis: {
+    ElvisNode &elvis = static_cast<ElvisNode&>(node);
+    visitExpression(elvis.getExpressionA(), fn);
+    visitExpression(elvis.getExpressionB(), fn);
+    break;
+  }
+  case NodeType::Block:
+    visitBlock(static_cast<BlockNode&>(node), fn);
+    break;
+  case NodeType::Tuple:
+    for (ExpressionNode *exp :
+        static_cast<TupleNode&>(node).getExpressionList()) {
+      visitExpression(*exp, fn);
+    }
+    break;
+  case NodeType::List:
+    for (ExpressionNode *exp :
+        static_cast<ListNode&>(node).getExpressionList()) {
+      visitExpression(*exp, fn);
+    }
+    break;
+  case NodeType::Struct:
+    for (StructPairNode *pair :
+        static_cast<StructNode&>(node).getStructPairList()) {
+      visitExpression(pair->getExpression(), fn);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void ClosureConversion::visitBlock(BlockNode &node, FunctionInfo *fn) {
+  DefinitionNode &def = node.getDefinition();
+  Binding *binding = nullptr;
+
+  if (def.getType() == NodeType::VariableDef) {
+    VariableDefNode &varDef = static_cast<VariableDefNode&>(def);
+    ExpressionNode &exp = varDef.getExpression();
+    binding = bind(varDef.getVariableRef().getQualifiedIdent(), fn);
+    visitExpression(exp, fn);
+    if (exp.getType() == NodeType::LambdaFunction) {
+      binding->function = functionsByNode[&exp];
+      bindingsByFunction[&exp] = binding;
+    }
+  } else if (def.getType() == NodeType::FunctionDef) {
+    FunctionDefNode &funcDef = static_cast<FunctionDefNode&>(def);
+    binding = bind(
+      funcDef.getHeader().getVariableRef().getQualifiedIdent(),
+      fn
+    );
+    binding->function = newFunction(fn, &funcDef);
+    bindingsByFunction[&funcDef] = binding;
+    // The function is in scope in its own body.
+    scope.push_back(binding);
+    visitFunction(binding->function, funcDef.getParams(),
+      funcDef.getExpression());
+    scope.pop_back();
+  }
+
+  if (binding != nullptr) {
+    scope.push_back(binding);
+  }
+  visitExpression(node.getExpression(), fn);
+  if (binding != nullptr) {
+    scope.pop_back();
+  }
+}
+
+void ClosureConversion::visitFunction(
+  FunctionInfo *info,
+  std::forward_list<FunctionParamNode*> &params,
+  ExpressionNode &body
+) {
+  size_t savedScope = scope.size();
+  for (FunctionParamNode *param : inSourceOrder(params)) {
+    scope.push_back(bind(param->getName(), info));
+  }
+  visitExpression(body, info);
+  scope.resize(savedScope);
+}
+
+// Records that the function containing `site`, and every function between
+// it and the function that owns `binding`, needs the value of `binding`.
+bool ClosureConversion::markFree(Binding *binding, FunctionInfo *site) {
+  bool changed = false;
+  for (FunctionInfo *fn = site; fn != nullptr && fn != binding->owner;
+      fn = fn->parent) {
+    std::vector<Binding*> &free = fn->freeValues;
+    if (std::find(free.begin(), free.end(), binding) == free.end()) {
+      free.push_back(binding);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void ClosureConversion::computeFreeValues() {
+  for (std::unique_ptr<FunctionInfo> &fn : functions) {
+    fn->freeValues.clear();
+  }
+
+  // A direct call to a lifted function needs no value for the function
+  // itself, but the caller has to be able to pass it its free variables.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (Reference &ref : references) {
+      Binding *binding = ref.binding;
+      if (ref.callee && binding->function != nullptr && !binding->escapes) {
+        for (size_t i = 0; i < binding->function->freeValues.size(); i++) {
+          changed |= markFree(binding->function->freeValues[i], ref.site);
+        }
+      } else {
+        changed |= markFree(binding, ref.site);
+      }
+    }
+  }
+}
+
+// A lifted call site passes the callee's free variables by name, so each of
+// those names must mean the same binding at the call site as at the
+// definition. Functions called from where that is not the case escape.
+// Returns whether any binding was newly marked as escaping.
+bool ClosureConversion::findShadowedCalls() {
+  bool changed = false;
+  for (Reference &ref : references) {
+    Binding *binding = ref.binding;
+    if (binding->function == nullptr || binding->escapes) {
+      continue;
+    }
+    for (Binding *free : binding->function->freeValues) {
+      auto visible = std::find_if(ref.scope.rbegin(), ref.scope.rend(),
+        [free](Binding *inScope) { return inScope->name == free->name; });
+      if (visible == ref.scope.rend() || *visible != free) {
+        binding->escapes = true;
+        changed = true;
+        break;
+      }
+    }
+  }
+  return changed;
+}
+
+bool ClosureConversion::isLifted(Node &function) {
+  auto found = bindingsByFunction.find(&function);
+  return found != bindingsByFunction.end() && !found->second->escapes;
+}
+
+std::vector<std::string> ClosureConversion::liftedFreeValues(Node &function) {
+  std::vector<std::string> names;
+  auto found = functionsByNode.find(&function);
+  if (found != functionsByNode.end()) {
+    for (Binding *free : found->second->freeValues) {
+      names.push_back(free->name);
+    }
+  }
+  return names;
+}
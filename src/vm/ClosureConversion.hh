@@ -0,0 +1,75 @@
+#ifndef SRC_VM_CLOSURE_CONVERSION_HH
+#define SRC_VM_CLOSURE_CONVERSION_HH
+
+#include "../ast/Node.hh"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Works out which function bindings can be lambda-lifted before the file is
+// compiled. A function binding (a function definition, or a variable bound
+// directly to a lambda) that is only ever called by name, and never used as
+// a value, does not escape: it needs no closure object, and its free
+// variables are passed to it in registers as extra arguments instead.
+class ClosureConversion {
+  struct FunctionInfo;
+
+  struct Binding {
+    std::string name;
+    FunctionInfo *owner;
+    // Set when the binding holds a function we might lift.
+    FunctionInfo *function;
+    bool escapes;
+  };
+
+  struct FunctionInfo {
+    FunctionInfo *parent;
+    Node *node;
+    // Bindings from enclosing functions whose values this function needs.
+    std::vector<Binding*> freeValues;
+  };
+
+  struct Reference {
+    Binding *binding;
+    FunctionInfo *site;
+    bool callee;
+    // The bindings in scope at the reference, for function bindings only.
+    std::vector<Binding*> scope;
+  };
+
+  // Own every function and binding; the rest only point into these.
+  std::vector<std::unique_ptr<FunctionInfo>> functions;
+  std::vector<std::unique_ptr<Binding>> bindings;
+  std::vector<Reference> references;
+  std::vector<Binding*> scope;
+  std::map<Node*, FunctionInfo*> functionsByNode;
+  std::map<Node*, Binding*> bindingsByFunction;
+
+  FunctionInfo *newFunction(FunctionInfo *parent, Node *node);
+  Binding *bind(const std::string &name, FunctionInfo *owner);
+  void reference(VariableRefNode &node, FunctionInfo *site, bool callee);
+
+  void visitExpression(ExpressionNode &node, FunctionInfo *fn);
+  void visitBlock(BlockNode &node, FunctionInfo *fn);
+  void visitFunction(
+    FunctionInfo *info,
+    std::forward_list<FunctionParamNode*> &params,
+    ExpressionNode &body
+  );
+
+  bool markFree(Binding *binding, FunctionInfo *site);
+  void computeFreeValues();
+  bool findShadowedCalls();
+
+public:
+  void analyze(FileNode &file);
+
+  // Whether the function for this lambda or function definition is lifted.
+  bool isLifted(Node &function);
+  // The free variables a lifted function takes as extra arguments, in order.
+  std::vector<std::string> liftedFreeValues(Node &function);
+};
+
+#endif
@@ -0,0 +1,645 @@
+#include "Compiler.hh"
+#include "AtomTable.hh"
+#include "Builtins.hh"
+#include "Errors.hh"
+#include "List.hh"
+#include "Object.hh"
+#include "Profiler.hh"
+
+#include <algorithm>
+
+int Compiler::allocRegister() {
+  int reg = current->freeReg++;
+  if (reg >= maxRegisters) {
+    throw CompileError("function " + current->proto->name
+      + " needs more than 256 registers");
+  }
+  if (current->freeReg > current->proto->registerCount) {
+    current->proto->registerCount = current->freeReg;
+  }
+  return reg;
+}
+
+int Compiler::emit(Instr instr) {
+  current->proto->code.push_back(instr);
+  return current->proto->code.size() - 1;
+}
+
+// Always the last instruction of a function, where the profiler expects it.
+void Compiler::emitReturn(int result) {
+  emit(encodeABC(profiling ? Op::Exit : Op::Return, result, 0, 0));
+}
+
+// Records that only the registers allocated so far are live across the call
+// just emitted. Registers above them hold finished temporaries.
+void Compiler::recordStackMap() {
+  current->proto->stackMap.push_back({
+    int(current->proto->code.size()),
+    current->freeReg
+  });
+}
+
+int Compiler::addConstant(Value value) {
+  std::vector<Value> &constants = current->proto->constants;
+  // Equal bits mean the same number, atom or pooled string.
+  for (size_t i = 0; i < constants.size(); i++) {
+    if (constants[i] == value) {
+      return i;
+    }
+  }
+  constants.push_back(value);
+  return constants.size() - 1;
+}
+
+void Compiler::declareLocal(const std::string &name, int reg) {
+  current->locals.push_back({ name, reg, nullptr, {} });
+}
+
+void Compiler::declareLifted(
+  const std::string &name,
+  Proto *proto,
+  std::vector<std::string> freeValues
+) {
+  current->locals.push_back({ name, -1, proto, freeValues });
+}
+
+int Compiler::findLocal(FunctionState &state, const std::string &name) {
+  for (auto it = state.locals.rbegin(); it != state.locals.rend(); ++it) {
+    if (it->name == name) {
+      return it->reg;
+    }
+  }
+  return -1;
+}
+
+// Resolves `name` as a value captured from an enclosing function, adding
+// captures along the way as needed. Returns -1 if no enclosing function
+// binds `name`.
+int Compiler::findCapture(FunctionState &state, const std::string &name) {
+  for (size_t i = 0; i < state.captureNames.size(); i++) {
+    if (state.captureNames[i] == name) {
+      return i;
+    }
+  }
+  if (state.parent == nullptr) {
+    return -1;
+  }
+
+  Capture capture;
+  int reg = findLocal(*state.parent, name);
+  if (reg >= 0) {
+    capture.from = reg == state.selfRegister
+      ? CaptureFrom::Self
+      : CaptureFrom::Register;
+    capture.index = reg;
+  } else {
+    int index = findCapture(*state.parent, name);
+    if (index < 0) {
+      return -1;
+    }
+    capture.from = CaptureFrom::Capture;
+    capture.index = index;
+  }
+
+  if (state.lifted) {
+    // Closure conversion should have made this a free value parameter.
+    throw CompileError("lifted function " + state.proto->name
+      + " cannot capture " + name);
+  }
+  state.proto->captures.push_back(capture);
+  state.captureNames.push_back(name);
+  return state.captureNames.size() - 1;
+}
+
+// Finds the lifted function `name` refers to, if it refers to one.
+Compiler::Local *Compiler::findLifted(const std::string &name) {
+  for (FunctionState *state = current; state != nullptr;
+      state = state->parent) {
+    for (auto it = state->locals.rbegin(); it != state->locals.rend(); ++it) {
+      if (it->name == name) {
+        return it->lifted != nullptr ? &*it : nullptr;
+      }
+    }
+  }
+  return nullptr;
+}
+
+Proto *Compiler::compile(FileNode &file) {
+  closures.analyze(file);
+
+  Proto *proto = new Proto("main");
+  FunctionState state = { nullptr, proto, {}, {}, 0, -1, false };
+  current = &state;
+
+  if (profiling) {
+    Profiler::registerFunction(current->proto);
+    emit(encodeABC(Op::Enter, 0, 0, 0));
+  }
+  int result = allocRegister();
+  compileExpression(file.getRootExpression(), result);
+  emitReturn(result);
+
+  current = nullptr;
+  strings.seal();
+  return proto;
+}
+
+void Compiler::compileExpression(ExpressionNode &node, int target) {
+  switch (node.getType()) {
+  case NodeType::Number: {
+    Value num = Value::number(static_cast<NumberNode&>(node).getValue());
+    emit(encodeABx(Op::LoadK, target, addConstant(num)));
+    break;
+  }
+  case NodeType::String: {
+    StringNode &str = static_cast<StringNode&>(node);
+    Value strVal = Value::object(strings.intern(str.getValue()));
+    emit(encodeABx(Op::LoadK, target, addConstant(strVal)));
+    break;
+  }
+  case NodeType::Atom: {
+    AtomNode &atom = static_cast<AtomNode&>(node);
+    Value atomVal = Value::atom(AtomTable::program().intern(atom.getValue()));
+    emit(encodeABx(Op::LoadK, target, addConstant(atomVal)));
+    break;
+  }
+  case NodeType::VariableRef:
+    compileName(
+      static_cast<VariableRefNode&>(node).getQualifiedIdent(),
+      target
+    );
+    break;
+  case NodeType::FunctionCall:
+    compileFunctionCall(static_cast<FunctionCallNode&>(node), target);
+    break;
+  case NodeType::LambdaFunction: {
+    LambdaFunctionNode &lambda = static_cast<LambdaFunctionNode&>(node);
+    compileFunction(
+      current->proto->name + ".lambda",
+      lambda.getParams(),
+      lambda.getExpression(),
+      lambda.getLocation(),
+      target,
+      -1
+    );
+    break;
+  }
+  case NodeType::Elvis:
+    compileElvis(static_cast<ElvisNode&>(node), target);
+    break;
+  case NodeType::Block:
+    compileBlock(static_cast<BlockNode&>(node), target);
+    break;
+  case NodeType::Tuple:
+    compileSequence(
+      Op::MakeTuple,
+      static_cast<TupleNode&>(node).getExpressionList(),
+      target
+    );
+    break;
+  case NodeType::List:
+    compileList(static_cast<ListNode&>(node), target);
+    break;
+  case NodeType::Struct:
+    compileStruct(static_cast<StructNode&>(node), target);
+    break;
+  default:
+    throw CompileError("unexpected node in expression position");
+  }
+}
+
+void Compiler::compileName(const std::string &name, int target) {
+  int reg = findLocal(*current, name);
+  if (reg >= 0) {
+    if (reg != target) {
+      emit(encodeABC(Op::Move, target, reg, 0));
+    }
+    return;
+  }
+
+  int capture = findCapture(*current, name);
+  if (capture >= 0) {
+    emit(encodeABC(Op::GetCapture, target, capture, 0));
+    return;
+  }
+
+  Value constant;
+  if (findBuiltinConstant(name, constant)) {
+    emit(encodeABx(Op::LoadK, target, addConstant(constant)));
+    return;
+  }
+
+  int builtin = findBuiltin(name);
+  if (builtin >= 0) {
+    emit(encodeABx(Op::LoadBuiltin, target, builtin));
+    return;
+  }
+
+  throw CompileError("unbound variable " + name);
+}
+
+void Compiler::compileFunctionCall(FunctionCallNode &node, int target) {
+  ExpressionNode &calleeExp = node.getFunctionExp();
+  if (calleeExp.getType() == NodeType::VariableRef) {
+    Local *lifted = findLifted(
+      static_cast<VariableRefNode&>(calleeExp).getQualifiedIdent());
+    if (lifted != nullptr) {
+      compileDirectCall(node, *lifted, target);
+      return;
+    }
+    if (isMatchOnLiteral(node)) {
+      std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+      compileMatch(*args[0], static_cast<StructNode&>(*args[1]), target);
+      return;
+    }
+  }
+
+  std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+  int savedFreeReg = current->freeReg;
+
+  int base = allocRegister();
+  for (size_t i = 0; i < args.size(); i++) {
+    allocRegister();
+  }
+  compileExpression(node.getFunctionExp(), base);
+  for (size_t i = 0; i < args.size(); i++) {
+    compileExpression(*args[i], base + 1 + i);
+  }
+
+  emit(encodeABC(Op::Call, base, args.size(), 0));
+  current->proto->callCaches.push_back(CallCache());
+  emit(current->proto->callCaches.size() - 1);
+  recordStackMap();
+
+  if (base != target) {
+    emit(encodeABC(Op::Move, target, base, 0));
+  }
+  current->freeReg = savedFreeReg;
+}
+
+// Whether `node` is a call of the `match` builtin with a struct literal.
+bool Compiler::isMatchOnLiteral(FunctionCallNode &node) {
+  ExpressionNode &calleeExp = node.getFunctionExp();
+  if (calleeExp.getType() != NodeType::VariableRef
+      || static_cast<VariableRefNode&>(calleeExp).getQualifiedIdent()
+        != "match") {
+    return false;
+  }
+  for (FunctionState *state = current; state != nullptr;
+      state = state->parent) {
+    for (Local &local : state->locals) {
+      if (local.name == "match") {
+        return false;
+      }
+    }
+  }
+  std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+  return args.size() == 2 && args[1]->getType() == NodeType::Struct;
+}
+
+// `match key {a: x b: y}` jumps straight to the case for the atom in `key`
+// through a table indexed by atom ID, and evaluates only that case. It is
+// `some` of the case's value, or `nothing` if no case is named by `key`. The
+// table has a slot for every atom between the lowest and highest case, so
+// when the cases are spread too thinly over that range they are tested one
+// after another instead.
+void Compiler::compileMatch(
+  ExpressionNode &key,
+  StructNode &cases,
+  int target
+) {
+  std::vector<StructPairNode*> pairs = inSourceOrder(cases.getStructPairList());
+  std::vector<Instr> &code = current->proto->code;
+  std::vector<SwitchTable> &tables = current->proto->switchTables;
+
+  std::vector<uint32_t> atoms;
+  for (StructPairNode *pair : pairs) {
+    atoms.push_back(AtomTable::program().intern(pair->getIdent()));
+  }
+  SwitchTable table;
+  table.minAtom = 0;
+  uint32_t range = 0;
+  if (!atoms.empty()) {
+    table.minAtom = *std::min_element(atoms.begin(), atoms.end());
+    range = *std::max_element(atoms.begin(), atoms.end()) - table.minAtom + 1;
+  }
+  bool useTable = range <= 64 || atoms.size() * 2 >= range;
+
+  compileExpression(key, target);
+  // Cases may contain matches of their own, so the table is filled in last.
+  int tableIndex = tables.size();
+  if (useTable) {
+    tables.push_back(SwitchTable());
+    emit(encodeABx(Op::Switch, target, tableIndex));
+  }
+
+  std::vector<int> starts;
+  std::vector<int> exits;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    // `key` stays in `target` until a case matches, and the first case with
+    // a given name wins, as in a struct lookup.
+    int test = -1;
+    if (!useTable) {
+      test = emit(encodeABx(Op::JumpIfNotAtom, target, 0));
+      emit(atoms[i]);
+    }
+    starts.push_back(code.size());
+    compileExpression(pairs[i]->getExpression(), target);
+    emit(encodeABC(Op::Some, target, 0, 0));
+    exits.push_back(emit(encodeABx(Op::Jump, 0, 0)));
+    if (test >= 0) {
+      int offset = code.size() - (test + 2);
+      code[test] = encodeABx(Op::JumpIfNotAtom, target, offset + sbxBias);
+    }
+  }
+
+  table.defaultTarget = code.size();
+  emit(encodeABx(Op::LoadK, target, addConstant(Value::nothing())));
+  for (int exit : exits) {
+    int offset = code.size() - (exit + 1);
+    code[exit] = encodeABx(Op::Jump, 0, offset + sbxBias);
+  }
+
+  if (useTable) {
+    table.targets.assign(range, table.defaultTarget);
+    for (size_t i = atoms.size(); i > 0; i--) {
+      table.targets[atoms[i - 1] - table.minAtom] = starts[i - 1];
+    }
+    tables[tableIndex] = table;
+  }
+}
+
+// Calls a lifted function, passing its free variables after the arguments.
+void Compiler::compileDirectCall(
+  FunctionCallNode &node,
+  Local &callee,
+  int target
+) {
+  std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+  // Copied, since compiling the arguments may grow the locals `callee` is in.
+  std::vector<std::string> freeValues = callee.liftedFreeValues;
+  Proto *proto = callee.lifted;
+  if (int(args.size()) != proto->paramCount - int(freeValues.size())) {
+    throw CompileError("wrong number of arguments to " + proto->name);
+  }
+  int savedFreeReg = current->freeReg;
+
+  int base = allocRegister();
+  for (int i = 0; i < proto->paramCount; i++) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < args.size(); i++) {
+    compileExpression(*args[i], base + 1 + i);
+  }
+  for (size_t i = 0; i < freeValues.size(); i++) {
+    compileName(freeValues[i], base + 1 + args.size() + i);
+  }
+
+  std::vector<Proto*> &callees = current->proto->callees;
+  size_t index = 0;
+  while (index < callees.size() && callees[index] != proto) {
+    index++;
+  }
+  if (index == callees.size()) {
+    callees.push_back(proto);
+  }
+  emit(encodeABC(Op::CallDirect, base, proto->paramCount, 0));
+  emit(index);
+  recordStackMap();
+
+  if (base != target) {
+    emit(encodeABC(Op::Move, target, base, 0));
+  }
+  current->freeReg = savedFreeReg;
+}
+
+// `a ?: b` evaluates `b` only when `a` is `nothing`. When `b` is a literal or
+// a variable, evaluating it eagerly is free of effects and cheap, so both
+// sides are computed and `ElvisSelect` picks one without branching.
+void Compiler::compileElvis(ElvisNode &node, int target) {
+  ExpressionNode &fallback = node.getExpressionB();
+  compileExpression(node.getExpressionA(), target);
+
+  switch (fallback.getType()) {
+  case NodeType::Number:
+  case NodeType::String:
+  case NodeType::Atom:
+  case NodeType::VariableRef: {
+    int savedFreeReg = current->freeReg;
+    int reg = allocRegister();
+    compileExpression(fallback, reg);
+    emit(encodeABC(Op::ElvisSelect, target, target, reg));
+    current->freeReg = savedFreeReg;
+    return;
+  }
+  default:
+    break;
+  }
+
+  int jump = emit(encodeABx(Op::Elvis, target, 0));
+  compileExpression(fallback, target);
+
+  int offset = current->proto->code.size() - (jump + 1);
+  current->proto->code[jump] = encodeABx(Op::Elvis, target, offset + sbxBias);
+}
+
+void Compiler::compileBlock(BlockNode &node, int target) {
+  int savedFreeReg = current->freeReg;
+  size_t savedLocals = current->locals.size();
+
+  DefinitionNode &def = node.getDefinition();
+  switch (def.getType()) {
+  case NodeType::VariableDef: {
+    VariableDefNode &varDef = static_cast<VariableDefNode&>(def);
+    std::string name = varDef.getVariableRef().getQualifiedIdent();
+    ExpressionNode &exp = varDef.getExpression();
+    if (closures.isLifted(exp)) {
+      LambdaFunctionNode &lambda = static_cast<LambdaFunctionNode&>(exp);
+      std::vector<std::string> freeValues = closures.liftedFreeValues(exp);
+      Proto *proto = new Proto(name);
+      compileProto(proto, lambda.getParams(), lambda.getExpression(),
+        lambda.getLocation(), -1, &freeValues);
+      declareLifted(name, proto, freeValues);
+      break;
+    }
+    int reg = allocRegister();
+    compileExpression(exp, reg);
+    declareLocal(name, reg);
+    break;
+  }
+  case NodeType::FunctionDef: {
+    FunctionDefNode &funcDef = static_cast<FunctionDefNode&>(def);
+    std::string name =
+      funcDef.getHeader().getVariableRef().getQualifiedIdent();
+    if (closures.isLifted(funcDef)) {
+      std::vector<std::string> freeValues = closures.liftedFreeValues(funcDef);
+      Proto *proto = new Proto(name);
+      declareLifted(name, proto, freeValues);
+      compileProto(proto, funcDef.getParams(), funcDef.getExpression(),
+        funcDef.getLocation(), -1, &freeValues);
+      break;
+    }
+    int reg = allocRegister();
+    declareLocal(name, reg);
+    compileFunction(
+      name,
+      funcDef.getParams(),
+      funcDef.getExpression(),
+      funcDef.getLocation(),
+      reg,
+      reg
+    );
+    break;
+  }
+  default:
+    // Type definitions have no runtime representation.
+    break;
+  }
+
+  compileExpression(node.getExpression(), target);
+  current->locals.resize(savedLocals);
+  current->freeReg = savedFreeReg;
+}
+
+void Compiler::compileSequence(
+  Op op,
+  std::forward_list<ExpressionNode*> &members,
+  int target
+) {
+  std::vector<ExpressionNode*> ordered = inSourceOrder(members);
+  int savedFreeReg = current->freeReg;
+
+  int base = current->freeReg;
+  for (size_t i = 0; i < ordered.size(); i++) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < ordered.size(); i++) {
+    compileExpression(*ordered[i], base + i);
+  }
+  emit(encodeABC(op, target, base, ordered.size()));
+
+  current->freeReg = savedFreeReg;
+}
+
+// A list literal made only of literals is built once, at compile time, since
+// lists are immutable. Any other literal is built by `MakeList` from
+// consecutive registers in a single chunk copy.
+void Compiler::compileList(ListNode &node, int target) {
+  std::vector<ExpressionNode*> members =
+    inSourceOrder(node.getExpressionList());
+  for (ExpressionNode *member : members) {
+    NodeType type = member->getType();
+    if (type != NodeType::Number && type != NodeType::String
+        && type != NodeType::Atom) {
+      compileSequence(Op::MakeList, node.getExpressionList(), target);
+      return;
+    }
+  }
+
+  ListBuilder builder;
+  for (ExpressionNode *member : members) {
+    switch (member->getType()) {
+    case NodeType::Number:
+      builder.add(
+        Value::number(static_cast<NumberNode*>(member)->getValue()));
+      break;
+    case NodeType::String:
+      builder.add(Value::object(
+        strings.intern(static_cast<StringNode*>(member)->getValue())));
+      break;
+    default:
+      builder.add(Value::atom(AtomTable::program().intern(
+        static_cast<AtomNode*>(member)->getValue())));
+      break;
+    }
+  }
+  Value list = Value::object(builder.build());
+  emit(encodeABx(Op::LoadK, target, addConstant(list)));
+}
+
+void Compiler::compileStruct(StructNode &node, int target) {
+  std::vector<StructPairNode*> pairs =
+    inSourceOrder(node.getStructPairList());
+  int savedFreeReg = current->freeReg;
+
+  std::vector<uint32_t> shape;
+  int base = current->freeReg;
+  for (size_t i = 0; i < pairs.size(); i++) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < pairs.size(); i++) {
+    shape.push_back(AtomTable::program().intern(pairs[i]->getIdent()));
+    compileExpression(pairs[i]->getExpression(), base + i);
+  }
+
+  current->proto->structShapes.push_back(shape);
+  emit(encodeABC(Op::MakeStruct, target, base, pairs.size()));
+  emit(current->proto->structShapes.size() - 1);
+
+  current->freeReg = savedFreeReg;
+}
+
+// Compiles a function that is used as a value. Functions that capture
+// nothing become a single closure constant; the rest allocate a closure with
+// a flat environment each time the definition is evaluated.
+void Compiler::compileFunction(
+  const std::string &name,
+  std::forward_list<FunctionParamNode*> &params,
+  ExpressionNode &body,
+  const SourceLocation &location,
+  int target,
+  int selfRegister
+) {
+  Proto *proto = new Proto(name);
+  compileProto(proto, params, body, location, selfRegister, nullptr);
+
+  if (proto->captures.empty()) {
+    stats.constant++;
+    Value closure = Value::object(new ClosureObj(*proto, {}));
+    emit(encodeABx(Op::LoadK, target, addConstant(closure)));
+  } else {
+    stats.heap++;
+    emit(encodeABx(Op::Closure, target, current->proto->protos.size() - 1));
+  }
+}
+
+// Compiles a function body into `proto` and adds it to the current function's
+// protos. A lifted function gets its free variables as extra parameters.
+void Compiler::compileProto(
+  Proto *proto,
+  std::forward_list<FunctionParamNode*> &params,
+  ExpressionNode &body,
+  const SourceLocation &location,
+  int selfRegister,
+  const std::vector<std::string> *liftedFreeValues
+) {
+  bool lifted = liftedFreeValues != nullptr;
+  proto->line = location.line;
+  proto->column = location.column;
+  FunctionState state = {
+    current, proto, {}, {}, 0, selfRegister, lifted
+  };
+  current = &state;
+
+  for (FunctionParamNode *param : inSourceOrder(params)) {
+    declareLocal(param->getName(), allocRegister());
+    proto->paramCount++;
+  }
+  if (lifted) {
+    stats.lifted++;
+    for (const std::string &name : *liftedFreeValues) {
+      declareLocal(name, allocRegister());
+      proto->paramCount++;
+    }
+  }
+  if (profiling) {
+    Profiler::registerFunction(current->proto);
+    emit(encodeABC(Op::Enter, 0, 0, 0));
+  }
+  int result = allocRegister();
+  compileExpression(body, result);
+  emitReturn(result);
+
+  current = state.parent;
+  current->proto->protos.push_back(proto);
+}
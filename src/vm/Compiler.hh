@@ -0,0 +1,127 @@
+#ifndef SRC_VM_COMPILER_HH
+#define SRC_VM_COMPILER_HH
+
+#include "../ast/Node.hh"
+#include "./Bytecode.hh"
+#include "./ClosureConversion.hh"
+#include "./StringPool.hh"
+
+#include <forward_list>
+#include <string>
+#include <vector>
+
+// How the functions in a compiled file were represented.
+struct ClosureStats {
+  // Lifted functions, whose environment is passed in registers.
+  int lifted = 0;
+  // Closures without captures, allocated once at compile time.
+  int constant = 0;
+  // Closures allocated with a flat environment every time they are created.
+  int heap = 0;
+};
+
+// Lowers a parsed file to register bytecode. Closure conversion runs over the
+// whole file first; everything else is done in a single pass over the AST.
+class Compiler {
+  struct Local {
+    std::string name;
+    int reg;
+    // Set instead of `reg` for a lifted function, which has no value.
+    Proto *lifted;
+    std::vector<std::string> liftedFreeValues;
+  };
+
+  struct FunctionState {
+    FunctionState *parent;
+    Proto *proto;
+    std::vector<Local> locals;
+    std::vector<std::string> captureNames;
+    int freeReg;
+    // The register in `parent` holding this function, if it is recursive.
+    int selfRegister;
+    bool lifted;
+  };
+
+  FunctionState *current = nullptr;
+  ClosureConversion closures;
+  ClosureStats stats;
+  StringPool strings;
+  bool profiling = false;
+
+  int allocRegister();
+  int emit(Instr instr);
+  void emitReturn(int result);
+  void recordStackMap();
+  int addConstant(Value value);
+  void declareLocal(const std::string &name, int reg);
+  void declareLifted(
+    const std::string &name,
+    Proto *proto,
+    std::vector<std::string> freeValues
+  );
+
+  int findLocal(FunctionState &state, const std::string &name);
+  int findCapture(FunctionState &state, const std::string &name);
+  Local *findLifted(const std::string &name);
+
+  void compileExpression(ExpressionNode &node, int target);
+  void compileName(const std::string &name, int target);
+  void compileFunctionCall(FunctionCallNode &node, int target);
+  void compileDirectCall(FunctionCallNode &node, Local &callee, int target);
+  bool isMatchOnLiteral(FunctionCallNode &node);
+  void compileMatch(ExpressionNode &key, StructNode &cases, int target);
+  void compileElvis(ElvisNode &node, int target);
+  void compileBlock(BlockNode &node, int target);
+  void compileSequence(
+    Op op,
+    std::forward_list<ExpressionNode*> &members,
+    int target
+  );
+  void compileList(ListNode &node, int target);
+  void compileStruct(StructNode &node, int target);
+  void compileFunction(
+    const std::string &name,
+    std::forward_list<FunctionParamNode*> &params,
+    ExpressionNode &body,
+    const SourceLocation &location,
+    int target,
+    int selfRegister
+  );
+  void compileProto(
+    Proto *proto,
+    std::forward_list<FunctionParamNode*> &params,
+    ExpressionNode &body,
+    const SourceLocation &location,
+    int selfRegister,
+    const std::vector<std::string> *liftedFreeValues
+  );
+
+public:
+  Compiler() {}
+  ~Compiler() {}
+
+  Proto *compile(FileNode &file);
+
+  // Brackets every function with `Enter` and `Exit`, so the VM reports its
+  // calls and time to the `Profiler`.
+  void setProfiling(bool enabled) { profiling = enabled; }
+
+  const ClosureStats &getClosureStats() {
+    return stats;
+  }
+
+  // The compiled module's string literals. Sealed by `compile`.
+  const StringPool &getStrings() {
+    return strings;
+  }
+};
+
+// The parser builds its lists back to front; this returns them in the order
+// they were written in the source.
+template <typename T>
+std::vector<T*> inSourceOrder(std::forward_list<T*> &list) {
+  std::vector<T*> ordered(list.begin(), list.end());
+  return std::vector<T*>(ordered.rbegin(), ordered.rend());
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SRC_VM_ERRORS_HH
+#define SRC_VM_ERRORS_HH
+
+#include <stdexcept>
+#include <string>
+
+// Raised while lowering the AST to bytecode, e.g. for an unbound variable.
+class CompileError: public std::runtime_error {
+public:
+  CompileError(const std::string &msg): std::runtime_error(msg) {}
+};
+
+// Raised while evaluating a program, e.g. when calling a non-function.
+class RuntimeError: public std::runtime_error {
+public:
+  RuntimeError(const std::string &msg): std::runtime_error(msg) {}
+};
+
+// Raised when a program recurses deeper than the evaluator running it can go.
+class StackOverflowError: public RuntimeError {
+public:
+  StackOverflowError(const std::string &msg): RuntimeError(msg) {}
+};
+
+#endif
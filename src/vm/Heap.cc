@@ -0,0 +1,288 @@
+#include "Heap.hh"
+#include "List.hh"
+#include "Object.hh"
+
+#include <algorithm>
+#include <new>
+
+// Keeps every header, and so every object, 8-byte aligned.
+static size_t alignedSize(size_t size) {
+  return (size + 7) & ~size_t(7);
+}
+
+// Moves `from` into the memory at `to`, leaving `from` to be discarded
+// without running its destructor.
+static Obj *moveObject(Obj *from, void *to) {
+  switch (from->type) {
+  case ObjType::String:
+    return new (to) StringObj(std::move(*static_cast<StringObj*>(from)));
+  case ObjType::Tuple:
+    return new (to) TupleObj(std::move(*static_cast<TupleObj*>(from)));
+  case ObjType::List:
+    return new (to) ListObj(*static_cast<ListObj*>(from));
+  case ObjType::ListChunk:
+    return new (to) ListChunkObj(*static_cast<ListChunkObj*>(from));
+  case ObjType::ListBranch:
+    return new (to) ListBranchObj(*static_cast<ListBranchObj*>(from));
+  case ObjType::Struct:
+    return new (to) StructObj(std::move(*static_cast<StructObj*>(from)));
+  case ObjType::Closure:
+    return new (to) ClosureObj(std::move(*static_cast<ClosureObj*>(from)));
+  case ObjType::AstClosure:
+    return new (to) AstClosureObj(*static_cast<AstClosureObj*>(from));
+  }
+  return nullptr;
+}
+
+// Frees what a dead object owns outside the heap. Only objects holding a
+// vector or a string own anything.
+static void destroyObject(Obj *obj) {
+  switch (obj->type) {
+  case ObjType::String:
+    static_cast<StringObj*>(obj)->~StringObj();
+    break;
+  case ObjType::Tuple:
+    static_cast<TupleObj*>(obj)->~TupleObj();
+    break;
+  case ObjType::Struct:
+    static_cast<StructObj*>(obj)->~StructObj();
+    break;
+  case ObjType::Closure:
+    static_cast<ClosureObj*>(obj)->~ClosureObj();
+    break;
+  default:
+    break;
+  }
+}
+
+Heap::Heap(): majorThreshold(minMajorThreshold), created(Clock::now()) {}
+
+Heap &Heap::current() {
+  static thread_local Heap heap;
+  return heap;
+}
+
+void *Heap::allocatePermanent(size_t size) {
+  Header *header = static_cast<Header*>(
+    ::operator new(sizeof(Header) + alignedSize(size)));
+  header->size = size;
+  header->space = Space::Permanent;
+  header->forwarded = false;
+  header->owner = nullptr;
+  return header + 1;
+}
+
+Heap::Block Heap::newBlock() {
+  char *start = new char[blockSize];
+  return { start, start, start + blockSize };
+}
+
+void *Heap::allocate(size_t size) {
+  size_t bytes = sizeof(Header) + alignedSize(size);
+  while (nurseryBlock == nursery.size()
+      || nursery[nurseryBlock].top + bytes > nursery[nurseryBlock].end) {
+    if (nurseryBlock < nursery.size()) {
+      nurseryBlock++;
+    }
+    if (nurseryBlock == nursery.size()) {
+      nursery.push_back(newBlock());
+    }
+  }
+
+  Block &block = nursery[nurseryBlock];
+  Header *header = reinterpret_cast<Header*>(block.top);
+  block.top += bytes;
+  header->size = size;
+  header->space = Space::Young;
+  header->forwarded = false;
+  header->owner = this;
+
+  youngBytes += bytes;
+  stats.objectsAllocated++;
+  stats.bytesAllocated += bytes;
+  return header + 1;
+}
+
+void *Heap::allocateOld(size_t size) {
+  size_t bytes = sizeof(Header) + alignedSize(size);
+  if (old.empty() || old.back().top + bytes > old.back().end) {
+    old.push_back(newBlock());
+  }
+
+  Block &block = old.back();
+  Header *header = reinterpret_cast<Header*>(block.top);
+  block.top += bytes;
+  header->size = size;
+  header->space = Space::Old;
+  header->forwarded = false;
+  header->owner = this;
+
+  oldBytes += bytes;
+  return header + 1;
+}
+
+// Copies `obj` out of the space being collected, unless it has been already
+// or is not being collected at all, and returns where it now is.
+Obj *Heap::forward(Obj *obj) {
+  Header *header = headerOf(obj);
+  if (header->forwarded) {
+    return header->forward;
+  }
+  if (header->space > collectedSpace || header->owner != this) {
+    return obj;
+  }
+
+  if (header->space == Space::Young) {
+    stats.youngBytesSurvived += sizeof(Header) + alignedSize(header->size);
+  }
+  Obj *copy = moveObject(obj, allocateOld(header->size));
+  header->forwarded = true;
+  header->forward = copy;
+  grey.push_back(copy);
+  return copy;
+}
+
+void Heap::trace(Value &value) {
+  if (value.isObject()) {
+    Obj *obj = value.asObject();
+    Obj *moved = forward(obj);
+    if (moved != obj) {
+      value = Value::object(moved);
+    }
+  }
+}
+
+void Heap::traceChildren(Obj *obj) {
+  switch (obj->type) {
+  case ObjType::Tuple:
+    for (Value &member : static_cast<TupleObj*>(obj)->members) {
+      trace(member);
+    }
+    break;
+  case ObjType::List: {
+    ListObj *list = static_cast<ListObj*>(obj);
+    trace(list->root);
+    trace(list->tail);
+    break;
+  }
+  case ObjType::ListChunk:
+    for (Value &value : static_cast<ListChunkObj*>(obj)->values) {
+      trace(value);
+    }
+    break;
+  case ObjType::ListBranch:
+    for (Obj *&child : static_cast<ListBranchObj*>(obj)->children) {
+      if (child != nullptr) {
+        trace(child);
+      }
+    }
+    break;
+  case ObjType::Struct:
+    for (auto &field : static_cast<StructObj*>(obj)->fields) {
+      trace(field.second);
+    }
+    break;
+  case ObjType::Closure:
+    for (Value &capture : static_cast<ClosureObj*>(obj)->captures) {
+      trace(capture);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Runs the destructors of the objects in `blocks` that were not copied out.
+void Heap::destroyGarbage(std::vector<Block> &blocks) {
+  for (Block &block : blocks) {
+    char *next = block.start;
+    while (next < block.top) {
+      Header *header = reinterpret_cast<Header*>(next);
+      if (!header->forwarded) {
+        destroyObject(reinterpret_cast<Obj*>(header + 1));
+      }
+      next += sizeof(Header) + alignedSize(header->size);
+    }
+  }
+}
+
+void Heap::collect(RootSet &roots) {
+  Clock::time_point start = Clock::now();
+  bool major = oldBytes >= majorThreshold
+    || (stress && (stats.minorCollections + stats.majorCollections) % 4 == 3);
+
+  std::vector<Block> oldFromSpace;
+  if (major) {
+    collectedSpace = Space::Old;
+    oldFromSpace.swap(old);
+    oldBytes = 0;
+  } else {
+    collectedSpace = Space::Young;
+  }
+  stats.youngBytesCollected += youngBytes;
+
+  roots.traceRoots(*this);
+  for (RootSet *scoped : scopedRoots) {
+    scoped->traceRoots(*this);
+  }
+  while (!grey.empty()) {
+    Obj *obj = grey.back();
+    grey.pop_back();
+    traceChildren(obj);
+  }
+
+  destroyGarbage(nursery);
+  for (Block &block : nursery) {
+    block.top = block.start;
+  }
+  // Give back the blocks the nursery grew by while it could not be collected.
+  size_t keptBlocks = nurseryLimit / blockSize + 1;
+  while (nursery.size() > keptBlocks) {
+    delete[] nursery.back().start;
+    nursery.pop_back();
+  }
+  nurseryBlock = 0;
+  youngBytes = 0;
+
+  if (major) {
+    destroyGarbage(oldFromSpace);
+    for (Block &block : oldFromSpace) {
+      delete[] block.start;
+    }
+    majorThreshold = oldBytes * 2 > minMajorThreshold
+      ? oldBytes * 2
+      : minMajorThreshold;
+    stats.majorCollections++;
+  } else {
+    stats.minorCollections++;
+  }
+
+  double pause = std::chrono::duration<double, std::milli>(
+    Clock::now() - start).count();
+  stats.totalPauseMillis += pause;
+  stats.maxPauseMillis = std::max(stats.maxPauseMillis, pause);
+}
+
+void Heap::printStats(std::ostream &out) const {
+  double seconds = std::chrono::duration<double>(Clock::now() - created)
+    .count();
+  double megabytes = stats.bytesAllocated / double(1 << 20);
+  int collections = stats.minorCollections + stats.majorCollections;
+
+  out << "allocated:        " << stats.objectsAllocated << " objects, "
+    << megabytes << " MB (" << megabytes / seconds << " MB/s)\n";
+  out << "collections:      " << stats.minorCollections << " minor, "
+    << stats.majorCollections << " major\n";
+  if (stats.youngBytesCollected > 0) {
+    out << "survivor ratio:   "
+      << 100.0 * stats.youngBytesSurvived / stats.youngBytesCollected
+      << "%\n";
+  }
+  if (collections > 0) {
+    out << "pauses:           " << stats.totalPauseMillis << " ms total, "
+      << stats.totalPauseMillis / collections << " ms mean, "
+      << stats.maxPauseMillis << " ms max\n";
+  }
+  out << "heap:             " << youngBytes / 1024 << " KB young, "
+    << oldBytes / 1024 << " KB old\n";
+}
@@ -0,0 +1,163 @@
+#ifndef SRC_VM_HEAP_HH
+#define SRC_VM_HEAP_HH
+
+#include "./Value.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class Heap;
+
+// Everything a collection starts from. The VM implements this with its
+// registers, frames and constants.
+class RootSet {
+public:
+  virtual ~RootSet() {}
+  virtual void traceRoots(Heap &heap) = 0;
+};
+
+struct HeapStats {
+  uint64_t objectsAllocated = 0;
+  uint64_t bytesAllocated = 0;
+  int minorCollections = 0;
+  int majorCollections = 0;
+  // Nursery bytes examined by minor collections, and how many survived.
+  uint64_t youngBytesCollected = 0;
+  uint64_t youngBytesSurvived = 0;
+  double totalPauseMillis = 0;
+  double maxPauseMillis = 0;
+};
+
+// The memory every `Obj` lives in. Each thread allocates into its own heap,
+// by bumping a pointer through the blocks of its nursery. A collection copies
+// what is reachable from a `RootSet`: a minor one promotes the nursery's
+// survivors into the old generation, and a major one, run once the old
+// generation has doubled, copies the old generation too.
+//
+// Lush objects are never changed once they are built, and none are built
+// across a safepoint, so an old object can never point at a young one and no
+// write barrier is needed. Objects with a different owner, and permanent
+// ones, are never moved and their fields are not traced, since they can only
+// point at objects of their own heap.
+class Heap {
+public:
+  enum class Space: uint8_t {
+    Young,
+    Old,
+    Permanent
+  };
+
+private:
+  // Precedes every object.
+  struct Header {
+    uint32_t size;
+    Space space;
+    bool forwarded;
+    union {
+      Heap *owner;
+      // Where the object was copied to, once `forwarded`.
+      Obj *forward;
+    };
+  };
+
+  struct Block {
+    char *start;
+    char *top;
+    char *end;
+  };
+
+  typedef std::chrono::steady_clock Clock;
+
+  std::vector<Block> nursery;
+  size_t nurseryBlock = 0;
+  std::vector<Block> old;
+  uint64_t youngBytes = 0;
+  uint64_t oldBytes = 0;
+  uint64_t majorThreshold;
+
+  std::vector<RootSet*> scopedRoots;
+  friend class ScopedRoots;
+
+  // The most senior space a running collection moves objects out of.
+  Space collectedSpace = Space::Young;
+  std::vector<Obj*> grey;
+
+  bool stress = false;
+  HeapStats stats;
+  Clock::time_point created;
+
+  static Header *headerOf(Obj *obj) {
+    return reinterpret_cast<Header*>(obj) - 1;
+  }
+
+  static Block newBlock();
+  void *allocateOld(size_t size);
+  Obj *forward(Obj *obj);
+  void traceChildren(Obj *obj);
+  void destroyGarbage(std::vector<Block> &blocks);
+
+public:
+  Heap();
+  // Blocks are never freed, since objects may outlive the thread that
+  // allocated them.
+  ~Heap() {}
+
+  // The calling thread's heap.
+  static Heap &current();
+  // For objects that live as long as the process, such as the empty list.
+  static void *allocatePermanent(size_t size);
+
+  void *allocate(size_t size);
+
+  // Whether the nursery is full, checked by the VM at its safepoints.
+  bool wantsCollection() const {
+    return stress || youngBytes >= nurseryLimit;
+  }
+  void collect(RootSet &roots);
+
+  // Called by a `RootSet` for each root. Updates the root if the object it
+  // points at was moved.
+  void trace(Value &value);
+  void trace(Obj *&obj) { obj = forward(obj); }
+  template <typename T>
+  void trace(T *&obj) {
+    Obj *moved = forward(obj);
+    obj = static_cast<T*>(moved);
+  }
+
+  // Collects at every safepoint, with every fourth collection a major one.
+  void setStress(bool enabled) { stress = enabled; }
+
+  const HeapStats &getStats() const { return stats; }
+  void printStats(std::ostream &out) const;
+
+  static const size_t blockSize = 1 << 20;
+  static const uint64_t nurseryLimit = 4 << 20;
+  static const uint64_t minMajorThreshold = 32 << 20;
+};
+
+// Makes `count` values at `values` roots of the calling thread's heap while
+// it is in scope.
+class ScopedRoots: public RootSet {
+  Heap &heap;
+  Value *values;
+  size_t count;
+
+public:
+  ScopedRoots(Value *rootValues, size_t rootCount):
+      heap(Heap::current()), values(rootValues), count(rootCount) {
+    heap.scopedRoots.push_back(this);
+  }
+  ~ScopedRoots() { heap.scopedRoots.pop_back(); }
+
+  void traceRoots(Heap &tracer) {
+    for (size_t i = 0; i < count; i++) {
+      tracer.trace(values[i]);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "List.hh"
+
+#include <algorithm>
+
+static ListBranchObj *emptyBranch() {
+  static ListBranchObj *branch =
+    new (Heap::Space::Permanent) ListBranchObj();
+  return branch;
+}
+
+// A chain of branches down to `chunk`, for a level of the trie that has no
+// node yet.
+static Obj *newPath(uint32_t level, ListChunkObj *chunk) {
+  if (level == 0) {
+    return chunk;
+  }
+  ListBranchObj *branch = new ListBranchObj();
+  branch->children[0] = newPath(level - listChunkBits, chunk);
+  return branch;
+}
+
+// Copies the path from `parent` down to where the full chunk ending at
+// physical index `lastIndex` belongs, and puts `chunk` there.
+static ListBranchObj *pushTail(
+  uint32_t lastIndex,
+  uint32_t level,
+  ListBranchObj *parent,
+  ListChunkObj *chunk
+) {
+  uint32_t index = (lastIndex >> level) & listChunkMask;
+  ListBranchObj *copy = new ListBranchObj(*parent);
+
+  if (level == uint32_t(listChunkBits)) {
+    copy->children[index] = chunk;
+  } else {
+    Obj *child = parent->children[index];
+    copy->children[index] = child != nullptr
+      ? pushTail(lastIndex, level - listChunkBits,
+          static_cast<ListBranchObj*>(child), chunk)
+      : newPath(level - listChunkBits, chunk);
+  }
+  return copy;
+}
+
+ListObj *ListObj::empty() {
+  static ListObj *emptyList = new (Heap::Space::Permanent) ListObj(0, 0,
+    listChunkBits, emptyBranch(), new (Heap::Space::Permanent) ListChunkObj());
+  return emptyList;
+}
+
+const Value *ListObj::chunkFor(uint32_t index) const {
+  if (index >= tailOffset()) {
+    return tail->values;
+  }
+  Obj *node = root;
+  for (uint32_t level = shift; level > 0; level -= listChunkBits) {
+    node = static_cast<ListBranchObj*>(node)->children[
+      (index >> level) & listChunkMask];
+  }
+  return static_cast<ListChunkObj*>(node)->values;
+}
+
+ListObj *ListObj::rest() {
+  if (size() <= 1) {
+    return empty();
+  }
+  return new ListObj(start + 1, end, shift, root, tail);
+}
+
+ListObj *ListObj::push(Value value) {
+  ListBuilder builder(this);
+  builder.add(value);
+  return builder.build();
+}
+
+ListBuilder::ListBuilder():
+  start(0),
+  count(0),
+  shift(listChunkBits),
+  root(emptyBranch()),
+  pending(new ListChunkObj()),
+  pendingCount(0) {}
+
+ListBuilder::ListBuilder(ListObj *prefix):
+  start(prefix->start),
+  count(prefix->tailOffset()),
+  shift(prefix->shift),
+  root(prefix->root),
+  pending(new ListChunkObj(*prefix->tail)),
+  pendingCount(prefix->end - prefix->tailOffset()) {}
+
+void ListBuilder::flushChunk() {
+  if (((count + listChunkSize) >> listChunkBits) > (1u << shift)) {
+    // The trie is full; grow it by a level.
+    ListBranchObj *newRoot = new ListBranchObj();
+    newRoot->children[0] = root;
+    newRoot->children[1] = newPath(shift, pending);
+    root = newRoot;
+    shift += listChunkBits;
+  } else {
+    root = pushTail(count + listChunkSize - 1, shift, root, pending);
+  }
+  count += listChunkSize;
+  pending = new ListChunkObj();
+  pendingCount = 0;
+}
+
+void ListBuilder::add(Value value) {
+  if (pendingCount == uint32_t(listChunkSize)) {
+    flushChunk();
+  }
+  pending->values[pendingCount++] = value;
+}
+
+void ListBuilder::addChunk(const Value *values, size_t valueCount) {
+  while (valueCount > 0) {
+    if (pendingCount == uint32_t(listChunkSize)) {
+      flushChunk();
+    }
+    size_t room = listChunkSize - pendingCount;
+    size_t copied = std::min(room, valueCount);
+    std::copy(values, values + copied, pending->values + pendingCount);
+    pendingCount += copied;
+    values += copied;
+    valueCount -= copied;
+  }
+}
+
+void ListBuilder::addAll(ListObj *other) {
+  other->forEachChunk([this](const Value *values, size_t valueCount) {
+    addChunk(values, valueCount);
+  });
+}
+
+ListObj *ListBuilder::build() {
+  uint32_t end = count + pendingCount;
+  if (end == start) {
+    return ListObj::empty();
+  }
+  return new ListObj(start, end, shift, root, pending);
+}
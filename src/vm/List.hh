@@ -0,0 +1,124 @@
+#ifndef SRC_VM_LIST_HH
+#define SRC_VM_LIST_HH
+
+#include "./Object.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+const int listChunkBits = 5;
+const int listChunkSize = 1 << listChunkBits;
+const int listChunkMask = listChunkSize - 1;
+
+// A leaf of a list's trie: up to 32 contiguous values.
+class ListChunkObj: public Obj {
+public:
+  Value values[listChunkSize];
+
+  ListChunkObj(): Obj(ObjType::ListChunk) {}
+};
+
+// An interior node of a list's trie. Its children are chunks one level above
+// the leaves and branches everywhere else.
+class ListBranchObj: public Obj {
+public:
+  Obj *children[listChunkSize] = {};
+
+  ListBranchObj(): Obj(ObjType::ListBranch) {}
+};
+
+// Lush's `T[]`: an immutable vector stored as a 32-way trie of contiguous
+// chunks, with the last chunk kept outside the trie so appending is cheap.
+// Updates copy only the path to the changed chunk and share everything else.
+// `start` lets `tail` drop the first element without copying anything.
+class ListObj: public Obj {
+  // Physical indices of the elements; `[start, end)` are visible.
+  uint32_t start;
+  uint32_t end;
+  // Bits of a physical index consumed above the leaves of `root`.
+  uint32_t shift;
+  ListBranchObj *root;
+  ListChunkObj *tail;
+
+  ListObj(
+    uint32_t first,
+    uint32_t count,
+    uint32_t rootShift,
+    ListBranchObj *rootNode,
+    ListChunkObj *tailChunk
+  ):  Obj(ObjType::List),
+      start(first),
+      end(count),
+      shift(rootShift),
+      root(rootNode),
+      tail(tailChunk) {}
+
+  uint32_t tailOffset() const {
+    return end < uint32_t(listChunkSize) ? 0 : (end - 1) & ~listChunkMask;
+  }
+
+  const Value *chunkFor(uint32_t index) const;
+
+  friend class ListBuilder;
+  friend class Heap;
+
+public:
+  static ListObj *empty();
+
+  size_t size() const { return end - start; }
+  bool isEmpty() const { return start == end; }
+
+  Value get(size_t index) const {
+    uint32_t physical = start + index;
+    return chunkFor(physical)[physical & listChunkMask];
+  }
+
+  Value front() const { return get(0); }
+
+  // The list without its first element. Shares all storage with this one.
+  ListObj *rest();
+  // A new list with `value` appended.
+  ListObj *push(Value value);
+
+  // Calls `fn(values, count)` for each run of contiguous elements in order.
+  template <typename F>
+  void forEachChunk(F fn) const {
+    uint32_t index = start;
+    while (index < end) {
+      uint32_t chunkEnd = (index & ~listChunkMask) + listChunkSize;
+      if (chunkEnd > end) {
+        chunkEnd = end;
+      }
+      fn(chunkFor(index) + (index & listChunkMask), size_t(chunkEnd - index));
+      index = chunkEnd;
+    }
+  }
+};
+
+// Builds a list by appending, filling each chunk in place before it is
+// shared with anything. A builder must not be used after `build()`.
+class ListBuilder {
+  uint32_t start;
+  // Elements in the trie under `root`; always a multiple of the chunk size.
+  uint32_t count;
+  uint32_t shift;
+  ListBranchObj *root;
+  ListChunkObj *pending;
+  uint32_t pendingCount;
+
+  void flushChunk();
+
+public:
+  ListBuilder();
+  // Starts from an existing list, which is left unchanged.
+  ListBuilder(ListObj *prefix);
+  ~ListBuilder() {}
+
+  void add(Value value);
+  void addChunk(const Value *values, size_t count);
+  void addAll(ListObj *other);
+
+  ListObj *build();
+};
+
+#endif
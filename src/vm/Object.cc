@@ -0,0 +1,150 @@
+#include "Object.hh"
+#include "AtomTable.hh"
+#include "List.hh"
+
+#include <sstream>
+
+bool isObjType(Value value, ObjType type) {
+  return value.isObject() && value.asObject()->type == type;
+}
+
+bool isTruthy(Value value) {
+  return value.isBool() && value.asBool();
+}
+
+bool valuesEqual(Value a, Value b) {
+  if (a.isNumber() && b.isNumber()) {
+    return a.asNumber() == b.asNumber();
+  }
+  if (a == b) {
+    return true;
+  }
+  if (!a.isObject() || !b.isObject()) {
+    return false;
+  }
+
+  Obj *objA = a.asObject();
+  Obj *objB = b.asObject();
+  if (objA->type != objB->type) {
+    return false;
+  }
+
+  switch (objA->type) {
+  case ObjType::String:
+    return static_cast<StringObj*>(objA)->equals(
+      *static_cast<StringObj*>(objB));
+  case ObjType::Tuple: {
+    std::vector<Value> &membersA = static_cast<TupleObj*>(objA)->members;
+    std::vector<Value> &membersB = static_cast<TupleObj*>(objB)->members;
+    if (membersA.size() != membersB.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < membersA.size(); i++) {
+      if (!valuesEqual(membersA[i], membersB[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case ObjType::List: {
+    ListObj *listA = static_cast<ListObj*>(objA);
+    ListObj *listB = static_cast<ListObj*>(objB);
+    if (listA->size() != listB->size()) {
+      return false;
+    }
+    for (size_t i = 0; i < listA->size(); i++) {
+      if (!valuesEqual(listA->get(i), listB->get(i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    // Structs and functions compare by identity.
+    return false;
+  }
+}
+
+static void writeValue(std::ostringstream &out, Value value) {
+  if (value.isNumber()) {
+    out << value.asNumber();
+    return;
+  }
+  if (value.isUnit()) {
+    out << "{}";
+    return;
+  }
+  if (value.isBool()) {
+    out << (value.asBool() ? "true" : "false");
+    return;
+  }
+  if (value.isBuiltin()) {
+    out << "<builtin>";
+    return;
+  }
+  if (value.isAtom()) {
+    out << ':' << AtomTable::program().name(value.asAtom());
+    return;
+  }
+  if (value.isOption()) {
+    for (uint64_t i = 0; i < value.optionDepth(); i++) {
+      out << "some ";
+    }
+    out << "nothing";
+    return;
+  }
+
+  Obj *obj = value.asObject();
+  switch (obj->type) {
+  case ObjType::String:
+    out << '"' << static_cast<StringObj*>(obj)->str() << '"';
+    break;
+  case ObjType::Tuple: {
+    out << '{';
+    bool first = true;
+    for (Value member : static_cast<TupleObj*>(obj)->members) {
+      out << (first ? "" : " ");
+      writeValue(out, member);
+      first = false;
+    }
+    out << '}';
+    break;
+  }
+  case ObjType::List: {
+    out << '[';
+    bool first = true;
+    static_cast<ListObj*>(obj)->forEachChunk(
+      [&](const Value *values, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+          out << (first ? "" : " ");
+          writeValue(out, values[i]);
+          first = false;
+        }
+      });
+    out << ']';
+    break;
+  }
+  case ObjType::Struct: {
+    bool first = true;
+    for (auto &field : static_cast<StructObj*>(obj)->fields) {
+      out << (first ? "" : " ") << AtomTable::program().name(field.first)
+        << ": ";
+      writeValue(out, field.second);
+      first = false;
+    }
+    break;
+  }
+  case ObjType::Closure:
+  case ObjType::AstClosure:
+    out << "<function>";
+    break;
+  default:
+    break;
+  }
+}
+
+std::string showValue(Value value) {
+  std::ostringstream out;
+  writeValue(out, value);
+  return out.str();
+}
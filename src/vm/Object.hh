@@ -0,0 +1,143 @@
+#ifndef SRC_VM_OBJECT_HH
+#define SRC_VM_OBJECT_HH
+
+#include "./Heap.hh"
+#include "./Value.hh"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Proto;
+class Node;
+class TreeEnv;
+
+enum class ObjType {
+  String,
+  Tuple,
+  List,
+  ListChunk,
+  ListBranch,
+  Struct,
+  Closure,
+  AstClosure
+};
+
+// Abstract
+class Obj {
+public:
+  const ObjType type;
+
+  Obj(ObjType objType): type(objType) {}
+
+  // Objects live in the calling thread's `Heap` and are freed by collecting
+  // it, never by `delete`.
+  static void *operator new(size_t size) {
+    return Heap::current().allocate(size);
+  }
+  // `new (Heap::Space::Permanent)`, for objects that are never collected.
+  static void *operator new(size_t size, Heap::Space space) {
+    return Heap::allocatePermanent(size);
+  }
+  static void *operator new(size_t size, void *place) { return place; }
+  static void operator delete(void *obj) {}
+  static void operator delete(void *obj, Heap::Space space) {}
+  static void operator delete(void *obj, void *place) {}
+};
+
+// A string's characters are either its own or borrowed from a module's
+// sealed `StringPool` segment, which string literals point into.
+class StringObj: public Obj {
+  std::string owned;
+  const char *chars;
+  size_t length;
+  bool pooled;
+
+  // For `StringPool`, which points the string into its segment once sealed.
+  StringObj(size_t pooledLength):
+    Obj(ObjType::String), chars(nullptr), length(pooledLength), pooled(true) {}
+
+  friend class StringPool;
+
+public:
+  StringObj(const std::string &str):
+    Obj(ObjType::String),
+    owned(str),
+    chars(owned.data()),
+    length(str.size()),
+    pooled(false) {}
+  StringObj(const StringObj &other) = delete;
+  // Used by the collector. Owned characters may move with the string.
+  StringObj(StringObj &&other):
+    Obj(ObjType::String),
+    owned(std::move(other.owned)),
+    chars(other.pooled ? other.chars : owned.data()),
+    length(other.length),
+    pooled(other.pooled) {}
+
+  const char *data() const { return chars; }
+  size_t size() const { return length; }
+  std::string str() const { return std::string(chars, length); }
+
+  bool equals(const StringObj &other) const {
+    return length == other.length
+      && std::equal(chars, chars + length, other.chars);
+  }
+};
+
+class TupleObj: public Obj {
+public:
+  std::vector<Value> members;
+
+  TupleObj(std::vector<Value> values):
+    Obj(ObjType::Tuple), members(std::move(values)) {}
+};
+
+// Field names are atom IDs, so looking a field up compares integers.
+class StructObj: public Obj {
+public:
+  std::vector<std::pair<uint32_t, Value>> fields;
+
+  StructObj(std::vector<std::pair<uint32_t, Value>> pairs):
+    Obj(ObjType::Struct), fields(std::move(pairs)) {}
+
+  // The field named by atom `id`, or `nothing`.
+  Value field(uint32_t id) {
+    for (auto &pair : fields) {
+      if (pair.first == id) {
+        return Value::some(pair.second);
+      }
+    }
+    return Value::nothing();
+  }
+};
+
+// A bytecode function together with the values it captured.
+class ClosureObj: public Obj {
+public:
+  Proto &proto;
+  std::vector<Value> captures;
+
+  ClosureObj(Proto &fnProto, std::vector<Value> captured):
+    Obj(ObjType::Closure), proto(fnProto), captures(std::move(captured)) {}
+};
+
+// A function as seen by the tree-walking evaluator: the lambda or function
+// definition node and the environment it was created in.
+class AstClosureObj: public Obj {
+public:
+  Node &function;
+  TreeEnv *env;
+
+  AstClosureObj(Node &fn, TreeEnv *fnEnv):
+    Obj(ObjType::AstClosure), function(fn), env(fnEnv) {}
+};
+
+bool isObjType(Value value, ObjType type);
+
+bool isTruthy(Value value);
+bool valuesEqual(Value a, Value b);
+std::string showValue(Value value);
+
+#endif
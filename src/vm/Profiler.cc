@@ -0,0 +1,363 @@
+#include "Profiler.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <string>
+
+typedef std::chrono::steady_clock Clock;
+
+// Every thread's profiler and every profiled function, and when the first
+// profiler started, which reports use to turn cycles into time.
+static std::mutex registryMutex;
+static std::vector<Profiler*> registry;
+static std::vector<Proto*> functionTable;
+static Clock::time_point firstStart;
+static uint64_t firstStartCycles;
+// What timing one call costs: reading the clock on entry and on exit.
+static uint64_t timerCycles;
+
+Profiler::Profiler(): events(bufferEvents) {
+  next = events.data();
+  end = events.data() + events.size();
+  nodes.push_back({ -1, 0, 0, 0, 0, {} });
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  if (registry.empty()) {
+    firstStart = Clock::now();
+    firstStartCycles = readCycles();
+    const int reads = 256;
+    uint64_t start = readCycles();
+    for (int i = 0; i < reads; i++) {
+      readCycles();
+    }
+    timerCycles = 2 * (readCycles() - start) / reads;
+  }
+  registry.push_back(this);
+}
+
+Profiler &Profiler::current() {
+  // Never freed, so that a report can still read it once the thread is gone.
+  static thread_local Profiler *profiler = new Profiler();
+  return *profiler;
+}
+
+void Profiler::registerFunction(Proto *proto) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  proto->profileId = functionTable.size();
+  functionTable.push_back(proto);
+}
+
+int Profiler::childFor(std::vector<CallNode> &tree, int parent,
+    int function) {
+  for (int child : tree[parent].children) {
+    if (tree[child].function == function) {
+      return child;
+    }
+  }
+  tree.push_back({ function, 0, 0, 0, 0, {} });
+  int child = tree.size() - 1;
+  tree[parent].children.push_back(child);
+  return child;
+}
+
+void Profiler::addCounts() {
+  for (int function : pendingFunctions) {
+    if (next == end) {
+      flush();
+    }
+    *next++ = { pendingCounts[function], function, EventKind::Count };
+    pendingCounts[function] = 0;
+  }
+  pendingFunctions.clear();
+}
+
+// Ends the innermost open call at `cycles`.
+void Profiler::closeCall(uint64_t cycles) {
+  OpenCall call = open.back();
+  open.pop_back();
+  CallNode &node = nodes[call.node];
+  uint64_t total = cycles - call.start;
+  uint64_t self = total - std::min(total, call.childCycles);
+  node.totalCycles += total;
+  node.selfCycles += self;
+  functions[node.function].selfCycles += self;
+  functions[node.function].callCycles += total;
+  if (!open.empty()) {
+    open.back().childCycles += total;
+  }
+}
+
+void Profiler::flush() {
+  uint64_t start = readCycles();
+  for (Event *event = events.data(); event < next; event++) {
+    if (event->kind == EventKind::Exit) {
+      closeCall(event->cycles);
+      continue;
+    }
+
+    int parent = open.empty() ? 0 : open.back().node;
+    int node = childFor(nodes, parent, event->function);
+    if (size_t(event->function) >= functions.size()) {
+      functions.resize(event->function + 1);
+    }
+    if (event->kind == EventKind::Count) {
+      nodes[node].untimedCalls += event->cycles;
+      functions[event->function].untimedCalls += event->cycles;
+      continue;
+    }
+    nodes[node].calls++;
+    open.push_back({ node, event->cycles, 0 });
+    functions[event->function].timedCalls++;
+  }
+  next = events.data();
+  throttle();
+
+  uint64_t pause = readCycles() - start;
+  for (OpenCall &call : open) {
+    call.start += pause;
+  }
+  flushes++;
+  flushCycles += pause;
+}
+
+// Stops timing functions whose calls are too short for it to be worth it.
+// Calls already under way are still timed until they return.
+void Profiler::throttle() {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  for (size_t id = 0; id < functions.size(); id++) {
+    FunctionTotals &totals = functions[id];
+    Proto *proto = functionTable[id];
+    if (!proto->untimed && totals.timedCalls >= throttleCalls
+        && totals.callCycles
+          < totals.timedCalls * throttleFactor * timerCycles) {
+      proto->untimed = true;
+      proto->code.front() = encodeABC(Op::Count, 0, 0, 0);
+    }
+  }
+}
+
+std::vector<Profiler::CallNode> Profiler::mergedTree(
+  std::vector<FunctionTotals> &totals,
+  uint64_t &flushCount,
+  uint64_t &flushTotal
+) {
+  std::vector<CallNode> merged;
+  merged.push_back({ -1, 0, 0, 0, 0, {} });
+  flushCount = 0;
+  flushTotal = 0;
+
+  for (Profiler *profiler : registry) {
+    profiler->addCounts();
+    profiler->flush();
+  }
+  std::lock_guard<std::mutex> lock(registryMutex);
+  totals.assign(functionTable.size(), FunctionTotals());
+  for (Profiler *profiler : registry) {
+    flushCount += profiler->flushes;
+    flushTotal += profiler->flushCycles;
+    for (size_t id = 0; id < profiler->functions.size(); id++) {
+      totals[id].timedCalls += profiler->functions[id].timedCalls;
+      totals[id].untimedCalls += profiler->functions[id].untimedCalls;
+      totals[id].selfCycles += profiler->functions[id].selfCycles;
+      totals[id].callCycles += profiler->functions[id].callCycles;
+    }
+
+    // Pairs of a node in `merged` and the node of `profiler` folded into it,
+    // walked without recursion since stacks can be as deep as the VM's.
+    std::vector<std::pair<int, int>> work = { { 0, 0 } };
+    while (!work.empty()) {
+      std::pair<int, int> pair = work.back();
+      work.pop_back();
+      for (int child : profiler->nodes[pair.second].children) {
+        const CallNode &from = profiler->nodes[child];
+        int into = childFor(merged, pair.first, from.function);
+        merged[into].calls += from.calls;
+        merged[into].untimedCalls += from.untimedCalls;
+        merged[into].totalCycles += from.totalCycles;
+        merged[into].selfCycles += from.selfCycles;
+        work.push_back({ into, child });
+      }
+    }
+  }
+  chargeUntimed(merged, totals);
+  return merged;
+}
+
+// Moves the estimated time of counted calls out of the self time of the timed
+// calls they ran in, and into the functions counted: their average self time
+// per timed call, and their average total time into their own totals. Each
+// estimate is capped at what its parent measured. Counted calls outside any
+// timed call have no measured time to take theirs from.
+void Profiler::chargeUntimed(
+  std::vector<CallNode> &tree,
+  std::vector<FunctionTotals> &totals
+) {
+  for (CallNode &parent : tree) {
+    if (parent.function < 0) {
+      continue;
+    }
+    for (int child : parent.children) {
+      CallNode &node = tree[child];
+      const FunctionTotals &measured = totals[node.function];
+      if (node.untimedCalls == 0 || measured.timedCalls == 0) {
+        continue;
+      }
+      uint64_t self = std::min(parent.selfCycles,
+        node.untimedCalls * measured.selfCycles / measured.timedCalls);
+      uint64_t room = parent.totalCycles
+        - std::min(parent.totalCycles, node.totalCycles);
+      uint64_t total = std::min(room,
+        node.untimedCalls * measured.callCycles / measured.timedCalls);
+      parent.selfCycles -= self;
+      node.selfCycles += self;
+      node.totalCycles += std::max(self, total);
+    }
+  }
+  // The estimates above all use the measured self times, so the totals are
+  // only brought up to date now.
+  for (FunctionTotals &function : totals) {
+    function.selfCycles = 0;
+  }
+  for (size_t i = 1; i < tree.size(); i++) {
+    totals[tree[i].function].selfCycles += tree[i].selfCycles;
+  }
+}
+
+static double cyclesPerMilli() {
+  double millis = std::chrono::duration<double, std::milli>(
+    Clock::now() - firstStart).count();
+  uint64_t cycles = Profiler::readCycles() - firstStartCycles;
+  return millis > 0 && cycles > 0 ? cycles / millis : 1;
+}
+
+static std::string functionLabel(int function) {
+  Proto *proto = functionTable[function];
+  if (proto->line == 0) {
+    return proto->name;
+  }
+  return proto->name + " (" + std::to_string(proto->line) + ":"
+    + std::to_string(proto->column) + ")";
+}
+
+// Calls `visit(node, path)` for every node below the root in depth-first
+// order, with `path` the nodes from the outermost call down to `node`.
+template <typename Visit>
+void Profiler::walkTree(const std::vector<CallNode> &tree, Visit visit) {
+  std::vector<int> path;
+  // Each entry is a node and how many of its children have been visited.
+  std::vector<std::pair<int, size_t>> work = { { 0, 0 } };
+  while (!work.empty()) {
+    std::pair<int, size_t> &top = work.back();
+    const std::vector<int> &children = tree[top.first].children;
+    if (top.second == children.size()) {
+      work.pop_back();
+      if (!path.empty()) {
+        path.pop_back();
+      }
+      continue;
+    }
+    int child = children[top.second++];
+    path.push_back(child);
+    visit(child, path);
+    work.push_back({ child, 0 });
+  }
+}
+
+void Profiler::printReport(std::ostream &out) {
+  std::vector<FunctionTotals> totals;
+  uint64_t flushCount;
+  uint64_t flushTotal;
+  std::vector<CallNode> nodes = mergedTree(totals, flushCount, flushTotal);
+  double perMilli = cyclesPerMilli();
+
+  // A recursive call's time is already in its outermost call's total.
+  std::vector<uint64_t> totalCycles(totals.size());
+  std::vector<int> depth(totals.size());
+  std::vector<int> seen;
+  walkTree(nodes, [&](int index, const std::vector<int> &path) {
+    while (seen.size() >= path.size()) {
+      depth[nodes[seen.back()].function]--;
+      seen.pop_back();
+    }
+    const CallNode &node = nodes[index];
+    if (depth[node.function]++ == 0) {
+      totalCycles[node.function] += node.totalCycles;
+    }
+    seen.push_back(index);
+  });
+
+  struct Row {
+    int function;
+    uint64_t timedCalls;
+    uint64_t calls;
+    uint64_t selfCycles;
+  };
+  std::vector<Row> rows;
+  uint64_t calls = 0;
+  bool anyUntimed = false;
+  for (size_t id = 0; id < totals.size(); id++) {
+    uint64_t untimedCalls = totals[id].untimedCalls;
+    uint64_t functionCalls = totals[id].timedCalls + untimedCalls;
+    if (functionCalls == 0) {
+      continue;
+    }
+    rows.push_back({
+      int(id), totals[id].timedCalls, functionCalls, totals[id].selfCycles
+    });
+    calls += functionCalls;
+    anyUntimed = anyUntimed || untimedCalls > 0;
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.selfCycles > b.selfCycles;
+  });
+
+  uint64_t profiled = 0;
+  for (int child : nodes[0].children) {
+    profiled += nodes[child].totalCycles;
+  }
+  out << "profiled:         " << calls << " calls, " << profiled / perMilli
+    << " ms\n";
+  out << "buffer flushes:   " << flushCount << ", " << flushTotal / perMilli
+    << " ms (not counted above)\n";
+  out << std::fixed;
+  out << std::setw(10) << "self ms" << std::setw(8) << "self %"
+    << std::setw(10) << "total ms" << std::setw(10) << "self us"
+    << std::setw(11) << "calls" << "  function\n";
+  for (Row &row : rows) {
+    double percent = profiled > 0 ? 100.0 * row.selfCycles / profiled : 0;
+    double perCall = row.selfCycles / perMilli * 1000 / row.calls;
+    out << std::setprecision(3) << std::setw(10) << row.selfCycles / perMilli
+      << std::setprecision(1) << std::setw(7) << percent << "%"
+      << std::setprecision(3) << std::setw(10)
+      << totalCycles[row.function] / perMilli
+      << std::setw(10) << perCall << std::setw(11) << row.calls
+      << "  " << functionLabel(row.function)
+      << (row.calls > row.timedCalls ? " *" : "") << "\n";
+  }
+  out << std::defaultfloat;
+  if (anyUntimed) {
+    out << "* timed for its first " << throttleCalls << " calls only; later "
+      << "calls are counted and\n  charged its average time per timed call\n";
+  }
+}
+
+void Profiler::writeFoldedStacks(std::ostream &out) {
+  std::vector<FunctionTotals> totals;
+  uint64_t flushCount;
+  uint64_t flushTotal;
+  std::vector<CallNode> nodes = mergedTree(totals, flushCount, flushTotal);
+  double perNano = cyclesPerMilli() / 1e6;
+
+  walkTree(nodes, [&](int index, const std::vector<int> &path) {
+    uint64_t nanos = nodes[index].selfCycles / perNano;
+    if (nanos == 0) {
+      return;
+    }
+    for (size_t i = 0; i < path.size(); i++) {
+      out << (i == 0 ? "" : ";") << functionLabel(nodes[path[i]].function);
+    }
+    out << " " << nanos << "\n";
+  });
+}
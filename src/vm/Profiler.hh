@@ -0,0 +1,163 @@
+#ifndef SRC_VM_PROFILER_HH
+#define SRC_VM_PROFILER_HH
+
+#include "./Bytecode.hh"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Counts and times calls to compiled functions, for programs compiled with
+// `Compiler::setProfiling`. The VM reports each `Enter` and `Exit` to the
+// calling thread's profiler, which only appends a timestamped event to a
+// buffer. A full buffer is folded into a calling-context tree, with a node per
+// distinct stack of functions holding its calls and the cycles spent in it,
+// and the time taken to fold is left out of every open call.
+//
+// Reading the clock costs about as much as a small Lush function, so once a
+// function has had `throttleCalls` timed calls taking, callees included,
+// under `throttleFactor` times the cost of timing one on average, its code
+// is rewritten to only count calls. Reports charge each counted call the
+// function's average self time per timed call, and take that time out of the
+// self time of the timed call it ran in. Like the call caches, this assumes a
+// proto only runs on one thread.
+//
+// Reports merge the trees of every thread that has profiled anything. Call
+// them once those threads are done running Lush code.
+class Profiler {
+  enum class EventKind: uint8_t {
+    Enter,
+    Exit,
+    // Calls counted but not timed since the previous event.
+    Count
+  };
+
+  struct Event {
+    // How many calls, for `Count`.
+    uint64_t cycles;
+    int function;
+    EventKind kind;
+  };
+
+  struct CallNode {
+    int function;
+    uint64_t calls;
+    // Counted calls made while the parent was the innermost timed call.
+    uint64_t untimedCalls;
+    uint64_t totalCycles;
+    uint64_t selfCycles;
+    std::vector<int> children;
+  };
+
+  struct OpenCall {
+    int node;
+    uint64_t start;
+    uint64_t childCycles;
+  };
+
+  struct FunctionTotals {
+    uint64_t timedCalls = 0;
+    uint64_t untimedCalls = 0;
+    uint64_t selfCycles = 0;
+    // Every timed call's total, recursive ones included, which is what the
+    // cost of timing a call is spread over.
+    uint64_t callCycles = 0;
+  };
+
+  std::vector<Event> events;
+  Event *next;
+  Event *end;
+  // Calls counted since the previous event, by function, and the functions
+  // with any. They all ran in the same timed call, so they become `Count`
+  // events only when the next event is added.
+  std::vector<uint64_t> pendingCounts;
+  std::vector<int> pendingFunctions;
+
+  // `nodes[0]` is the root, outside any function.
+  std::vector<CallNode> nodes;
+  std::vector<OpenCall> open;
+  // Indexed by `Proto::profileId`.
+  std::vector<FunctionTotals> functions;
+  uint64_t flushes = 0;
+  uint64_t flushCycles = 0;
+
+  Profiler();
+  void addCounts();
+  void flush();
+  void closeCall(uint64_t cycles);
+  void throttle();
+  static int childFor(std::vector<CallNode> &tree, int parent, int function);
+  static void chargeUntimed(
+    std::vector<CallNode> &tree,
+    std::vector<FunctionTotals> &totals
+  );
+  static std::vector<CallNode> mergedTree(
+    std::vector<FunctionTotals> &totals,
+    uint64_t &flushCount,
+    uint64_t &flushTotal
+  );
+  template <typename Visit>
+  static void walkTree(const std::vector<CallNode> &tree, Visit visit);
+
+public:
+  // The calling thread's profiler.
+  static Profiler &current();
+  // Gives `proto` a `profileId`. Called by the compiler.
+  static void registerFunction(Proto *proto);
+
+  static uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  void enter(Proto *proto) {
+    if (!pendingFunctions.empty()) {
+      addCounts();
+    }
+    if (next == end) {
+      flush();
+    }
+    *next++ = { readCycles(), proto->profileId, EventKind::Enter };
+  }
+
+  void exit(Proto *proto) {
+    if (!pendingFunctions.empty()) {
+      addCounts();
+    }
+    if (next == end) {
+      flush();
+    }
+    *next++ = { readCycles(), proto->profileId, EventKind::Exit };
+  }
+
+  void count(Proto *proto) {
+    if (size_t(proto->profileId) >= pendingCounts.size()) {
+      pendingCounts.resize(proto->profileId + 1);
+    }
+    if (pendingCounts[proto->profileId]++ == 0) {
+      pendingFunctions.push_back(proto->profileId);
+    }
+  }
+
+  // Calls, self time and total time of each function, hottest first.
+  static void printReport(std::ostream &out);
+  // One line per distinct stack, `main;f;g <self time in ns>`, the folded
+  // format that flame graph tools read.
+  static void writeFoldedStacks(std::ostream &out);
+
+  static const size_t bufferEvents = 1 << 9;
+  static const uint64_t throttleCalls = 100;
+  static const uint64_t throttleFactor = 50;
+};
+
+#endif
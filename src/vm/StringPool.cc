@@ -0,0 +1,72 @@
+#include "StringPool.hh"
+#include "Errors.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define LUSH_MMAP_STRINGS 1
+#else
+#define LUSH_MMAP_STRINGS 0
+#endif
+
+StringObj *StringPool::intern(const std::string &text) {
+  if (isSealed()) {
+    throw CompileError("string pool is already sealed");
+  }
+  auto found = entries.find(text);
+  if (found != entries.end()) {
+    return found->second.string;
+  }
+  Entry entry = {
+    uint32_t(building.size()),
+    uint32_t(text.size()),
+    new StringObj(text.size())
+  };
+  building += text;
+  entries[text] = entry;
+  return entry.string;
+}
+
+// Copies the segment into its own pages and makes them read-only, so a stray
+// write to a literal faults instead of changing every use of it.
+static const char *readOnlyCopy(const std::string &bytes) {
+  // Never empty, so that a sealed pool always has a segment.
+  size_t size = std::max<size_t>(bytes.size(), 1);
+#if LUSH_MMAP_STRINGS
+  void *pages = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages != MAP_FAILED) {
+    std::memcpy(pages, bytes.data(), bytes.size());
+    mprotect(pages, size, PROT_READ);
+    return static_cast<const char*>(pages);
+  }
+#endif
+  char *copy = new char[size];
+  std::memcpy(copy, bytes.data(), bytes.size());
+  return copy;
+}
+
+void StringPool::seal() {
+  if (isSealed()) {
+    return;
+  }
+  segment = readOnlyCopy(building);
+  for (auto &pair : entries) {
+    pair.second.string->chars = segment + pair.second.offset;
+  }
+}
+
+void StringPool::list(std::ostream &out) const {
+  std::vector<const Entry*> ordered;
+  for (auto &pair : entries) {
+    ordered.push_back(&pair.second);
+  }
+  std::sort(ordered.begin(), ordered.end(),
+    [](const Entry *a, const Entry *b) { return a->offset < b->offset; });
+  for (const Entry *entry : ordered) {
+    out << "  " << entry->offset << "\t" << entry->length << "\t\""
+      << building.substr(entry->offset, entry->length) << "\"\n";
+  }
+}
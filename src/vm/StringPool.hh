@@ -0,0 +1,51 @@
+#ifndef SRC_VM_STRING_POOL_HH
+#define SRC_VM_STRING_POOL_HH
+
+#include "./Object.hh"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A module's string literals, deduplicated into one contiguous segment and
+// referenced by offset and length. Each distinct literal gets a single
+// `StringObj` whose characters point into the segment, so no literal is ever
+// copied at runtime. The segment holds no pointers, so it can be written out
+// and mapped back in as is.
+class StringPool {
+  struct Entry {
+    uint32_t offset;
+    uint32_t length;
+    // Only used until the pool is sealed; the collector may move it later.
+    StringObj *string;
+  };
+
+  std::string building;
+  std::unordered_map<std::string, Entry> entries;
+  const char *segment = nullptr;
+
+public:
+  StringPool() {}
+  // The segment is kept, since the strings handed out point into it.
+  ~StringPool() {}
+
+  // The string for literal `text`. Its characters are only readable once the
+  // pool is sealed.
+  StringObj *intern(const std::string &text);
+
+  // Moves the segment into read-only memory and points every string at it.
+  // Nothing can be interned afterwards.
+  void seal();
+  bool isSealed() const { return segment != nullptr; }
+
+  const char *data() const { return segment; }
+  size_t size() const { return building.size(); }
+  size_t count() const { return entries.size(); }
+
+  // Each literal's offset, length and text, in offset order.
+  void list(std::ostream &out) const;
+};
+
+#endif
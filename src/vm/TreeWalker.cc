@@ -0,0 +1,204 @@
+#include "TreeWalker.hh"
+#include "AtomTable.hh"
+#include "Compiler.hh"
+#include "Errors.hh"
+#include "List.hh"
+
+#include <vector>
+
+Value TreeWalker::execute(FileNode &file) {
+  char base;
+  stackBase = &base;
+  return evaluate(file.getRootExpression(), nullptr);
+}
+
+Value TreeWalker::lookup(TreeEnv *env, VariableRefNode &node) {
+  std::string name = node.getQualifiedIdent();
+  for (TreeEnv *current = env; current != nullptr; current = current->parent) {
+    if (current->name == name) {
+      return current->value;
+    }
+  }
+
+  Value constant;
+  if (findBuiltinConstant(name, constant)) {
+    return constant;
+  }
+  int builtin = findBuiltin(name);
+  if (builtin >= 0) {
+    return Value::builtin(builtin);
+  }
+  throw RuntimeError("unbound variable " + name);
+}
+
+Value TreeWalker::call(Value callee, Value *args, int argCount) {
+  if (callee.isBuiltin()) {
+    const Builtin &builtin = getBuiltin(callee.asBuiltin());
+    if (builtin.arity != argCount) {
+      throw RuntimeError(std::string("wrong number of arguments to ")
+        + builtin.name);
+    }
+    return builtin.fn(*this, args);
+  }
+  if (!isObjType(callee, ObjType::AstClosure)) {
+    throw RuntimeError("cannot call " + showValue(callee));
+  }
+
+  // The stack grows down on every platform Lush runs on.
+  char top;
+  if (size_t(stackBase - &top) > maxStackBytes) {
+    throw StackOverflowError("stack overflow");
+  }
+
+  AstClosureObj *closure = static_cast<AstClosureObj*>(callee.asObject());
+  std::forward_list<FunctionParamNode*> *params;
+  ExpressionNode *body;
+  if (closure->function.getType() == NodeType::LambdaFunction) {
+    LambdaFunctionNode &lambda =
+      static_cast<LambdaFunctionNode&>(closure->function);
+    params = &lambda.getParams();
+    body = &lambda.getExpression();
+  } else {
+    FunctionDefNode &funcDef = static_cast<FunctionDefNode&>(closure->function);
+    params = &funcDef.getParams();
+    body = &funcDef.getExpression();
+  }
+
+  std::vector<FunctionParamNode*> ordered = inSourceOrder(*params);
+  if (int(ordered.size()) != argCount) {
+    throw RuntimeError("wrong number of arguments");
+  }
+
+  TreeEnv *env = closure->env;
+  for (int i = 0; i < argCount; i++) {
+    env = new TreeEnv(env, ordered[i]->getName(), args[i]);
+  }
+  return evaluate(*body, env);
+}
+
+Value TreeWalker::evaluateBlock(BlockNode &node, TreeEnv *env) {
+  DefinitionNode &def = node.getDefinition();
+  switch (def.getType()) {
+  case NodeType::VariableDef: {
+    VariableDefNode &varDef = static_cast<VariableDefNode&>(def);
+    Value value = evaluate(varDef.getExpression(), env);
+    env = new TreeEnv(env, varDef.getVariableRef().getQualifiedIdent(), value);
+    break;
+  }
+  case NodeType::FunctionDef: {
+    FunctionDefNode &funcDef = static_cast<FunctionDefNode&>(def);
+    env = new TreeEnv(
+      env,
+      funcDef.getHeader().getVariableRef().getQualifiedIdent(),
+      Value::unit()
+    );
+    env->value = Value::object(new AstClosureObj(funcDef, env));
+    break;
+  }
+  default:
+    break;
+  }
+  return evaluate(node.getExpression(), env);
+}
+
+// Mirrors the compiler: `match` with a struct literal evaluates only the case
+// the atom picks.
+bool TreeWalker::isMatchOnLiteral(FunctionCallNode &node, TreeEnv *env) {
+  ExpressionNode &calleeExp = node.getFunctionExp();
+  if (calleeExp.getType() != NodeType::VariableRef
+      || static_cast<VariableRefNode&>(calleeExp).getQualifiedIdent()
+        != "match") {
+    return false;
+  }
+  for (TreeEnv *current = env; current != nullptr; current = current->parent) {
+    if (current->name == "match") {
+      return false;
+    }
+  }
+  std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+  return args.size() == 2 && args[1]->getType() == NodeType::Struct;
+}
+
+Value TreeWalker::evaluateMatch(FunctionCallNode &node, TreeEnv *env) {
+  std::vector<ExpressionNode*> args = inSourceOrder(node.getArguments());
+  Value key = evaluate(*args[0], env);
+  if (!key.isAtom()) {
+    return Value::nothing();
+  }
+  for (StructPairNode *pair :
+      inSourceOrder(static_cast<StructNode*>(args[1])->getStructPairList())) {
+    if (AtomTable::program().intern(pair->getIdent()) == key.asAtom()) {
+      return Value::some(evaluate(pair->getExpression(), env));
+    }
+  }
+  return Value::nothing();
+}
+
+Value TreeWalker::evaluate(ExpressionNode &node, TreeEnv *env) {
+  switch (node.getType()) {
+  case NodeType::Number:
+    return Value::number(static_cast<NumberNode&>(node).getValue());
+  case NodeType::String:
+    return Value::object(
+      new StringObj(static_cast<StringNode&>(node).getValue()));
+  case NodeType::Atom:
+    return Value::atom(
+      AtomTable::program().intern(static_cast<AtomNode&>(node).getValue()));
+  case NodeType::VariableRef:
+    return lookup(env, static_cast<VariableRefNode&>(node));
+  case NodeType::FunctionCall: {
+    FunctionCallNode &callNode = static_cast<FunctionCallNode&>(node);
+    if (isMatchOnLiteral(callNode, env)) {
+      return evaluateMatch(callNode, env);
+    }
+    Value callee = evaluate(callNode.getFunctionExp(), env);
+    std::vector<Value> args;
+    for (ExpressionNode *arg : inSourceOrder(callNode.getArguments())) {
+      args.push_back(evaluate(*arg, env));
+    }
+    return call(callee, args.data(), args.size());
+  }
+  case NodeType::LambdaFunction:
+    return Value::object(new AstClosureObj(node, env));
+  case NodeType::Elvis: {
+    ElvisNode &elvis = static_cast<ElvisNode&>(node);
+    Value value = evaluate(elvis.getExpressionA(), env);
+    return value.isNothing()
+      ? evaluate(elvis.getExpressionB(), env)
+      : value.unwrap();
+  }
+  case NodeType::Block:
+    return evaluateBlock(static_cast<BlockNode&>(node), env);
+  case NodeType::Tuple: {
+    std::vector<Value> members;
+    for (ExpressionNode *exp :
+        inSourceOrder(static_cast<TupleNode&>(node).getExpressionList())) {
+      members.push_back(evaluate(*exp, env));
+    }
+    if (members.empty()) {
+      return Value::unit();
+    }
+    return Value::object(new TupleObj(members));
+  }
+  case NodeType::List: {
+    std::vector<ExpressionNode*> members =
+      inSourceOrder(static_cast<ListNode&>(node).getExpressionList());
+    ListBuilder builder;
+    for (ExpressionNode *exp : members) {
+      builder.add(evaluate(*exp, env));
+    }
+    return Value::object(builder.build());
+  }
+  case NodeType::Struct: {
+    std::vector<std::pair<uint32_t, Value>> fields;
+    for (StructPairNode *pair :
+        inSourceOrder(static_cast<StructNode&>(node).getStructPairList())) {
+      uint32_t id = AtomTable::program().intern(pair->getIdent());
+      fields.push_back({ id, evaluate(pair->getExpression(), env) });
+    }
+    return Value::object(new StructObj(fields));
+  }
+  default:
+    throw RuntimeError("unexpected node in expression position");
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef SRC_VM_TREE_WALKER_HH
+#define SRC_VM_TREE_WALKER_HH
+
+#include "../ast/Node.hh"
+#include "./Builtins.hh"
+#include "./Object.hh"
+
+#include <string>
+
+// One binding in the tree-walking evaluator's environment chain.
+class TreeEnv {
+public:
+  TreeEnv *parent;
+  std::string name;
+  Value value;
+
+  TreeEnv(TreeEnv *parentEnv, const std::string &bindingName, Value val):
+    parent(parentEnv), name(bindingName), value(val) {}
+};
+
+// Evaluates the AST directly, looking every variable up by name. It exists
+// as the baseline the bytecode VM is benchmarked against.
+//
+// Lush calls recurse on the C++ stack, so a call that would take the stack
+// more than `maxStackBytes` past where `execute` started raises a
+// `StackOverflowError` instead, short of the usual 8 MB limit.
+class TreeWalker: public Evaluator {
+  static const size_t maxStackBytes = 6 << 20;
+
+  const char *stackBase = nullptr;
+
+  Value lookup(TreeEnv *env, VariableRefNode &node);
+  Value evaluate(ExpressionNode &node, TreeEnv *env);
+  Value evaluateBlock(BlockNode &node, TreeEnv *env);
+  bool isMatchOnLiteral(FunctionCallNode &node, TreeEnv *env);
+  Value evaluateMatch(FunctionCallNode &node, TreeEnv *env);
+
+public:
+  TreeWalker() {}
+  ~TreeWalker() {}
+
+  Value execute(FileNode &file);
+  Value call(Value callee, Value *args, int argCount);
+};
+
+#endif
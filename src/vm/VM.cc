@@ -0,0 +1,400 @@
+#include "VM.hh"
+#include "Errors.hh"
+#include "List.hh"
+
+#include <algorithm>
+
+// Computed-goto dispatch jumps straight from one handler to the next, which
+// gives the branch predictor one indirect branch per opcode instead of a
+// single shared one. Fall back to a plain switch elsewhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define LUSH_COMPUTED_GOTO 1
+#else
+#define LUSH_COMPUTED_GOTO 0
+#endif
+
+static const size_t stackSize = 1 << 20;
+
+VM::VM(): stack(stackSize), heap(Heap::current()) {}
+
+Value *VM::stackTop() {
+  if (frames.empty()) {
+    return stack.data();
+  }
+  Frame &top = frames.back();
+  return top.regs + top.proto->registerCount;
+}
+
+void VM::pushFrame(Proto &proto, ClosureObj *closure, Value *regs) {
+  if (regs + proto.registerCount > stack.data() + stack.size()) {
+    throw StackOverflowError("stack overflow in " + proto.name);
+  }
+  frames.push_back({ &proto, closure, regs, proto.code.data(), false });
+  // Whatever an earlier frame left in these registers may since have been
+  // collected, and the collector scans them before they are written.
+  std::fill(regs + proto.paramCount, regs + proto.registerCount, Value());
+}
+
+Value VM::execute(Proto &main) {
+  frames.clear();
+  mainProto = &main;
+  pushFrame(main, nullptr, stackTop());
+  return run(0);
+}
+
+Value VM::call(Value callee, Value *args, int argCount) {
+  if (callee.isBuiltin()) {
+    const Builtin &builtin = getBuiltin(callee.asBuiltin());
+    if (builtin.arity != argCount) {
+      throw RuntimeError(std::string("wrong number of arguments to ")
+        + builtin.name);
+    }
+    // `args` may be another builtin's local array, which nothing else roots.
+    ScopedRoots rootArgs(args, argCount);
+    return builtin.fn(*this, args);
+  }
+  if (!isObjType(callee, ObjType::Closure)) {
+    throw RuntimeError("cannot call " + showValue(callee));
+  }
+
+  ClosureObj *closure = static_cast<ClosureObj*>(callee.asObject());
+  if (closure->proto.paramCount != argCount) {
+    throw RuntimeError("wrong number of arguments to " + closure->proto.name);
+  }
+
+  size_t depth = frames.size();
+  Value *regs = stackTop();
+  pushFrame(closure->proto, closure, regs);
+  for (int i = 0; i < argCount; i++) {
+    regs[i] = args[i];
+  }
+  if (heap.wantsCollection()) {
+    collectGarbage();
+  }
+  return run(depth);
+}
+
+// Validates `callee` for a call with `argCount` arguments and points `cache`
+// at it.
+static void fillCallCache(CallCache &cache, Value callee, int argCount) {
+  if (callee.isBuiltin()) {
+    const Builtin &builtin = getBuiltin(callee.asBuiltin());
+    if (builtin.arity != argCount) {
+      throw RuntimeError(std::string("wrong number of arguments to ")
+        + builtin.name);
+    }
+    cache.proto = nullptr;
+    cache.builtin = builtin.fn;
+  } else if (isObjType(callee, ObjType::Closure)) {
+    Proto &proto = static_cast<ClosureObj*>(callee.asObject())->proto;
+    if (proto.paramCount != argCount) {
+      throw RuntimeError("wrong number of arguments to " + proto.name);
+    }
+    cache.proto = &proto;
+    cache.builtin = nullptr;
+  } else {
+    throw RuntimeError("cannot call " + showValue(callee));
+  }
+  cache.calleeBits = callee.raw();
+}
+
+static void traceConstants(Heap &heap, Proto &proto) {
+  for (Value &constant : proto.constants) {
+    heap.trace(constant);
+  }
+  for (Proto *child : proto.protos) {
+    traceConstants(heap, *child);
+  }
+}
+
+// Collection may move a cached callee and reuse its address, so every cache
+// starts over afterwards.
+static void resetCallCaches(Proto &proto) {
+  for (CallCache &cache : proto.callCaches) {
+    cache = CallCache();
+  }
+  for (Proto *child : proto.protos) {
+    resetCallCaches(*child);
+  }
+}
+
+// Frames' register windows overlap where arguments are passed, so each
+// register is traced once, from the outermost frame in.
+void VM::traceRoots(Heap &heap) {
+  Value *traced = stack.data();
+  for (size_t i = 0; i < frames.size(); i++) {
+    Frame &frame = frames[i];
+    if (frame.closure != nullptr) {
+      heap.trace(frame.closure);
+    }
+    int live = i + 1 == frames.size()
+      ? frame.proto->registerCount
+      : frame.proto->liveRegisters(frame.pc - frame.proto->code.data());
+    for (Value *reg = std::max(traced, frame.regs); reg < frame.regs + live;
+        reg++) {
+      heap.trace(*reg);
+    }
+    traced = std::max(traced, frame.regs + live);
+  }
+  traceConstants(heap, *mainProto);
+}
+
+void VM::collectGarbage() {
+  heap.collect(*this);
+  resetCallCaches(*mainProto);
+}
+
+Value VM::run(size_t stopDepth) {
+  Proto *proto = frames.back().proto;
+  ClosureObj *closure = frames.back().closure;
+  Value *regs = frames.back().regs;
+  const Instr *pc = frames.back().pc;
+  Instr instr;
+
+#if LUSH_COMPUTED_GOTO
+  #define LUSH_OPCODE_LABEL(name) &&op_##name,
+  static void *dispatchTable[] = {
+    LUSH_OPCODES(LUSH_OPCODE_LABEL)
+  };
+  #undef LUSH_OPCODE_LABEL
+
+  #define VM_CASE(name) op_##name:
+  #define VM_DISPATCH() \
+    do { instr = *pc++; goto *dispatchTable[instr & 0xFF]; } while (0)
+
+#else
+  #define VM_CASE(name) case Op::name:
+  #define VM_DISPATCH() continue
+#endif
+
+  // Run on entry to a function, once its frame is pushed.
+  #define VM_SAFEPOINT() \
+    do { \
+      if (heap.wantsCollection()) { \
+        collectGarbage(); \
+        closure = frames.back().closure; \
+      } \
+    } while (0)
+
+#if LUSH_COMPUTED_GOTO
+  VM_DISPATCH();
+  {
+#else
+  for (;;) {
+    instr = *pc++;
+    switch (opOf(instr)) {
+#endif
+
+  VM_CASE(LoadK) {
+    regs[argA(instr)] = proto->constants[argBx(instr)];
+    VM_DISPATCH();
+  }
+
+  VM_CASE(LoadBuiltin) {
+    regs[argA(instr)] = Value::builtin(argBx(instr));
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Move) {
+    regs[argA(instr)] = regs[argB(instr)];
+    VM_DISPATCH();
+  }
+
+  VM_CASE(GetCapture) {
+    regs[argA(instr)] = closure->captures[argB(instr)];
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Closure) {
+    Proto &child = *proto->protos[argBx(instr)];
+    ClosureObj *obj = new ClosureObj(child, {});
+    Value objVal = Value::object(obj);
+    obj->captures.reserve(child.captures.size());
+    for (Capture &capture : child.captures) {
+      switch (capture.from) {
+      case CaptureFrom::Register:
+        obj->captures.push_back(regs[capture.index]);
+        break;
+      case CaptureFrom::Capture:
+        obj->captures.push_back(closure->captures[capture.index]);
+        break;
+      case CaptureFrom::Self:
+        obj->captures.push_back(objVal);
+        break;
+      }
+    }
+    regs[argA(instr)] = objVal;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Call) {
+    int a = argA(instr);
+    int argCount = argB(instr);
+    CallCache &cache = proto->callCaches[*pc++];
+    Value callee = regs[a];
+
+    if (callee.raw() != cache.calleeBits) {
+      fillCallCache(cache, callee, argCount);
+    }
+
+    if (cache.builtin != nullptr) {
+      frames.back().pc = pc;
+      regs[a] = cache.builtin(*this, regs + a + 1);
+      // A builtin that calls back into Lush code, such as `map`, may have
+      // collected and moved this frame's closure.
+      closure = frames.back().closure;
+      VM_DISPATCH();
+    }
+
+    frames.back().pc = pc;
+    Value *calleeRegs = regs + a + 1;
+    closure = static_cast<ClosureObj*>(callee.asObject());
+    proto = cache.proto;
+    pushFrame(*proto, closure, calleeRegs);
+    regs = calleeRegs;
+    pc = proto->code.data();
+    VM_SAFEPOINT();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(CallDirect) {
+    Proto *callee = proto->callees[*pc++];
+    frames.back().pc = pc;
+    Value *calleeRegs = regs + argA(instr) + 1;
+    pushFrame(*callee, nullptr, calleeRegs);
+    proto = callee;
+    closure = nullptr;
+    regs = calleeRegs;
+    pc = proto->code.data();
+    VM_SAFEPOINT();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Elvis) {
+    Value value = regs[argA(instr)];
+    if (!value.isNothing()) {
+      regs[argA(instr)] = value.unwrap();
+      pc += argSBx(instr);
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(ElvisSelect) {
+    Value value = regs[argB(instr)];
+    regs[argA(instr)] = value.isNothing() ? regs[argC(instr)] : value.unwrap();
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Some) {
+    regs[argA(instr)] = Value::some(regs[argA(instr)]);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Jump) {
+    pc += argSBx(instr);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Switch) {
+    SwitchTable &table = proto->switchTables[argBx(instr)];
+    Value key = regs[argA(instr)];
+    // Atoms below `minAtom` wrap around to large indices and miss too.
+    uint32_t index = key.asAtom() - table.minAtom;
+    int target = key.isAtom() && index < table.targets.size()
+      ? table.targets[index]
+      : table.defaultTarget;
+    pc = proto->code.data() + target;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(JumpIfNotAtom) {
+    Value key = regs[argA(instr)];
+    uint32_t atom = *pc++;
+    if (!key.isAtom() || key.asAtom() != atom) {
+      pc += argSBx(instr);
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(MakeTuple) {
+    int count = argC(instr);
+    if (count == 0) {
+      regs[argA(instr)] = Value::unit();
+    } else {
+      Value *members = regs + argB(instr);
+      regs[argA(instr)] = Value::object(
+        new TupleObj(std::vector<Value>(members, members + count)));
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(MakeList) {
+    ListBuilder builder;
+    builder.addChunk(regs + argB(instr), argC(instr));
+    regs[argA(instr)] = Value::object(builder.build());
+    VM_DISPATCH();
+  }
+
+  VM_CASE(MakeStruct) {
+    std::vector<uint32_t> &shape = proto->structShapes[*pc++];
+    std::vector<std::pair<uint32_t, Value>> fields;
+    for (int i = 0; i < argC(instr); i++) {
+      fields.push_back({ shape[i], regs[argB(instr) + i] });
+    }
+    regs[argA(instr)] = Value::object(new StructObj(fields));
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Enter) {
+    if (profiler == nullptr) {
+      profiler = &Profiler::current();
+    }
+    profiler->enter(proto);
+    frames.back().timed = true;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(Count) {
+    if (profiler == nullptr) {
+      profiler = &Profiler::current();
+    }
+    profiler->count(proto);
+    VM_DISPATCH();
+  }
+
+  // Falls through into `Return`. Calls that began before their function
+  // stopped being timed still end their timing here.
+  VM_CASE(Exit) {
+    if (frames.back().timed) {
+      profiler->exit(proto);
+    }
+  }
+
+  VM_CASE(Return) {
+    Value result = regs[argA(instr)];
+    frames.pop_back();
+    if (frames.size() == stopDepth) {
+      return result;
+    }
+
+    Frame &caller = frames.back();
+    proto = caller.proto;
+    closure = caller.closure;
+    regs = caller.regs;
+    pc = caller.pc;
+    // The call instruction and its cache slot are the two words before pc.
+    regs[argA(pc[-2])] = result;
+    VM_DISPATCH();
+  }
+
+#if LUSH_COMPUTED_GOTO
+  }
+#else
+    }
+  }
+#endif
+
+  #undef VM_CASE
+  #undef VM_DISPATCH
+  #undef VM_SAFEPOINT
+}
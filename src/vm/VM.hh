@@ -0,0 +1,52 @@
+#ifndef SRC_VM_VM_HH
+#define SRC_VM_VM_HH
+
+#include "./Builtins.hh"
+#include "./Bytecode.hh"
+#include "./Heap.hh"
+#include "./Object.hh"
+#include "./Profiler.hh"
+
+#include <vector>
+
+// Register-based bytecode interpreter. Lush calls do not recurse on the C++
+// stack; each call pushes a `Frame` whose registers are a window into one
+// shared value stack.
+//
+// Function entry is the VM's only safepoint, whether from bytecode or from a
+// builtin: the heap is collected there if it asks to be. A value returned by
+// `execute` stays valid until the next call to `execute`.
+class VM: public Evaluator, public RootSet {
+  struct Frame {
+    Proto *proto;
+    ClosureObj *closure;
+    Value *regs;
+    const Instr *pc;
+    // Whether `Enter` timed this call, so that `Exit` stops timing it.
+    bool timed;
+  };
+
+  std::vector<Value> stack;
+  std::vector<Frame> frames;
+  Heap &heap;
+  Proto *mainProto = nullptr;
+  // Set by the first `Enter`, so unprofiled programs never create one.
+  Profiler *profiler = nullptr;
+
+  Value *stackTop();
+  void pushFrame(Proto &proto, ClosureObj *closure, Value *regs);
+  Value run(size_t stopDepth);
+
+public:
+  VM();
+  ~VM() {}
+
+  Value execute(Proto &main);
+  Value call(Value callee, Value *args, int argCount);
+  void traceRoots(Heap &heap);
+  // Collects now rather than at the next safepoint, keeping the last program
+  // run's constants.
+  void collectGarbage();
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef SRC_VM_VALUE_HH
+#define SRC_VM_VALUE_HH
+
+#include <cstdint>
+#include <cstring>
+
+class Obj;
+
+// Values are NaN-boxed into a single 64-bit word. Every double is stored as
+// itself, except that NaNs are canonicalized to a positive quiet NaN. That
+// leaves the negative quiet NaN space (sign, exponent and quiet bit all set)
+// free, and we use the three bits below the quiet bit as a tag and the low 48
+// bits as the payload.
+//
+// Optionals (`T?`) are stored inline too. `some x` is just `x`, unless `x` is
+// itself `nothing` or a `some` around one; those values use the option tag,
+// with the number of `some`s wrapped around `nothing` as the payload. No
+// optional ever needs an allocation.
+class Value {
+  uint64_t bits;
+
+  static const uint64_t boxMask = 0xFFF8000000000000ull;
+  static const uint64_t tagMask = 0xFFFF000000000000ull;
+  static const uint64_t payloadMask = 0x0000FFFFFFFFFFFFull;
+  static const uint64_t canonicalNaN = 0x7FF8000000000000ull;
+
+  enum Tag: uint64_t {
+    UnitTag = 1,
+    BoolTag = 2,
+    BuiltinTag = 3,
+    ObjectTag = 4,
+    OptionTag = 5,
+    AtomTag = 6
+  };
+
+  static uint64_t boxed(Tag tag) {
+    return boxMask | (uint64_t(tag) << 48);
+  }
+
+  explicit Value(uint64_t raw): bits(raw) {}
+
+public:
+  Value(): bits(boxed(UnitTag)) {}
+
+  static Value number(double num) {
+    uint64_t raw;
+    std::memcpy(&raw, &num, sizeof(raw));
+    if (num != num) {
+      raw = canonicalNaN;
+    }
+    return Value(raw);
+  }
+
+  static Value unit() {
+    return Value(boxed(UnitTag));
+  }
+
+  static Value boolean(bool b) {
+    return Value(boxed(BoolTag) | (b ? 1 : 0));
+  }
+
+  static Value builtin(int index) {
+    return Value(boxed(BuiltinTag) | uint64_t(index));
+  }
+
+  static Value object(Obj *obj) {
+    return Value(boxed(ObjectTag) | reinterpret_cast<uint64_t>(obj));
+  }
+
+  // `id` is the atom's index in the program's `AtomTable`.
+  static Value atom(uint32_t id) {
+    return Value(boxed(AtomTag) | id);
+  }
+
+  static Value nothing() {
+    return Value(boxed(OptionTag));
+  }
+
+  static Value some(Value value) {
+    return value.isOption() ? Value(value.bits + 1) : value;
+  }
+
+  static Value fromRaw(uint64_t raw) {
+    return Value(raw);
+  }
+
+  // A boxed bit pattern with tag 0, which no value ever has.
+  static uint64_t sentinelBits() {
+    return boxMask;
+  }
+
+  uint64_t raw() const { return bits; }
+
+  bool isNumber() const { return (bits & boxMask) != boxMask; }
+  bool isUnit() const { return (bits & tagMask) == boxed(UnitTag); }
+  bool isBool() const { return (bits & tagMask) == boxed(BoolTag); }
+  bool isBuiltin() const { return (bits & tagMask) == boxed(BuiltinTag); }
+  bool isObject() const { return (bits & tagMask) == boxed(ObjectTag); }
+  bool isOption() const { return (bits & tagMask) == boxed(OptionTag); }
+  bool isNothing() const { return bits == boxed(OptionTag); }
+  bool isAtom() const { return (bits & tagMask) == boxed(AtomTag); }
+
+  double asNumber() const {
+    double num;
+    std::memcpy(&num, &bits, sizeof(num));
+    return num;
+  }
+
+  bool asBool() const { return (bits & 1) != 0; }
+  int asBuiltin() const { return int(bits & payloadMask); }
+  uint32_t asAtom() const { return uint32_t(bits & payloadMask); }
+
+  Obj *asObject() const {
+    return reinterpret_cast<Obj*>(bits & payloadMask);
+  }
+
+  // How many `some`s wrap `nothing` in an option-tagged value.
+  uint64_t optionDepth() const { return bits & payloadMask; }
+
+  // The value inside a present optional. Only valid if `!isNothing()`.
+  Value unwrap() const {
+    return Value(bits - (isOption() ? 1 : 0));
+  }
+
+  bool operator==(const Value &other) const { return bits == other.bits; }
+  bool operator!=(const Value &other) const { return bits != other.bits; }
+};
+
+#endif